@@ -0,0 +1,1089 @@
+/* bench.c
+ *
+ * Benchmarks for the list ADT
+ *
+ * Every list operation and every sort routine is run on lists of 10, 100,
+ * ... up to max_size elements, filled from random, sorted, reverse, nearly
+ * sorted and duplicate-heavy inputs.  One CSV line is printed per
+ * measurement:
+ *
+ *     op,variant,input,size,ns_per_op,compares_per_op
+ *
+ * For the sorts and for list_destruct an op is one element of the list.
+ * Small lists are measured repeatedly until about BENCH_MIN_WORK steps were
+ * taken (elements, or size * size for the quadratic routines), so their
+ * timings are not lost in clock noise.  The quadratic routines are only run
+ * up to BENCH_QUADRATIC_MAX elements.  LIST_DEFINE and LIST_DEFINE_COMPACT
+ * lists of ints from list_typed.h are built, sorted and searched alongside
+ * the generic list.
+ *
+ * The concurrent queue is measured once per size, with producers and
+ * consumers on separate threads, against a List guarded by one mutex.  Every
+ * run checks that each item came out exactly once and that no consumer saw
+ * the items of one producer out of order, so the benchmark doubles as a
+ * stress test of the queue.
+ *
+ * Usage: list_bench [max_size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include "list.h"
+#include "list_typed.h"
+
+LIST_DEFINE(intlist, int, (a < b) - (a > b))
+LIST_DEFINE_COMPACT(intcompact, int, (a < b) - (a > b))
+
+/* sort routines that list.c keeps private to the library */
+void insert_sort(list_t *);
+void recursive_select_sort(list_t *, Iterator, Iterator);
+void iter_select_sort(list_t *, Iterator, Iterator);
+void merge_sort(list_t *);
+void natural_sort(list_t *);
+
+#define BENCH_DEFAULT_MAX   10000000
+#define BENCH_MIN_SIZE      10
+#define BENCH_MIN_WORK      100000  /* steps per measurement */
+#define BENCH_QUADRATIC_MAX 10000
+#define BENCH_INSERTS       100     /* out of place elements in "sorted_k" */
+#define BENCH_DISTINCT      16      /* distinct values in "duplicates" */
+#define BENCH_PROBES        100     /* list_elem_find calls per measurement */
+#define BENCH_THREADS       4
+#define BENCH_QUEUE_ITEMS   1000000 /* most items pushed per measurement */
+#define BENCH_VISIT_WORK    64      /* rounds of bench_mix per visited element */
+#define BENCH_SET_LISTS     8       /* lists merged by list_merge_many */
+#define BENCH_TOP_K         10      /* elements list_partial_sort puts in front */
+#define BENCH_SAVE_PATH     "/tmp/list_bench.save"
+#define BENCH_SAVE_WORK     100     /* list_save writes a file, weigh it more */
+
+typedef enum {
+    INPUT_RANDOM,
+    INPUT_SORTED,
+    INPUT_REVERSE,
+    INPUT_SORTED_K,
+    INPUT_DUPLICATES,
+    INPUTS
+} input_t;
+
+static const char *input_names[] = {
+    "random", "sorted", "reverse", "sorted_k", "duplicates"
+};
+
+static long compares;
+static volatile long sink;      /* keeps results of timed loops alive */
+
+/* counts its calls so the benchmark can report comparisons per op */
+static int bench_comp(void *a, void *b)
+{
+    int x = *(int *) a, y = *(int *) b;
+
+    compares++;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* the same for list_sort_parallel, which compares from several threads */
+static int bench_comp_atomic(void *a, void *b)
+{
+    int x = *(int *) a, y = *(int *) b;
+
+    __atomic_add_fetch(&compares, 1, __ATOMIC_RELAXED);
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static unsigned long bench_hash(void *a)
+{
+    return (unsigned long) *(int *) a;
+}
+
+/* Stands in for heavy per element work in the list_foreach benchmarks */
+static unsigned int bench_mix(unsigned int x)
+{
+    int i;
+
+    for(i = 0; i < BENCH_VISIT_WORK; i++)
+        x = x * 1103515245 + 12345;
+    return x;
+}
+
+//Read only, as list_foreach callbacks should be; the rare hit keeps the work
+static void bench_visit(void *elem, void *arg)
+{
+    if(bench_mix(*(int *) elem) == 0)
+        __atomic_fetch_add((unsigned int *) arg, 1, __ATOMIC_RELAXED);
+}
+
+static void *bench_map(void *elem, void *arg)
+{
+    *(int *) elem = bench_mix(*(int *) elem) & 0x7fffffff;
+    return elem;
+}
+
+static int bench_keep(void *elem, void *arg)
+{
+    return bench_mix(*(int *) elem) & 1;
+}
+
+static void bench_reduce(void *acc, void *elem, void *arg)
+{
+    *(unsigned int *) acc += bench_mix(*(int *) elem);
+}
+
+static void bench_combine(void *acc, void *other, void *arg)
+{
+    *(unsigned int *) acc += *(unsigned int *) other;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int *new_elem(int value)
+{
+    int *elem = (int *) malloc(sizeof(int));
+
+    *elem = value;
+    return elem;
+}
+
+/* Fills values with size integers laid out as input says */
+static void fill_values(input_t input, int size, int *values)
+{
+    int i;
+
+    for(i = 0; i < size; i++)
+    {
+        switch(input)
+        {
+        case INPUT_RANDOM:
+            values[i] = rand();
+            break;
+        case INPUT_REVERSE:
+            values[i] = size - i;
+            break;
+        case INPUT_DUPLICATES:
+            values[i] = rand() % BENCH_DISTINCT;
+            break;
+        default:
+            values[i] = i;
+            break;
+        }
+    }
+
+    if(input == INPUT_SORTED_K)
+    {
+        for(i = 0; i < BENCH_INSERTS && i < size; i++)
+            values[rand() % size] = rand() % size;
+    }
+}
+
+static size_t bench_serialize(void *elem, void *buf, size_t buf_size)
+{
+    if(buf_size >= sizeof(int))
+        memcpy(buf, elem, sizeof(int));
+    return sizeof(int);
+}
+
+/* Builds an unsorted list holding values in order */
+static List build_list(int *values, int size)
+{
+    List list_ptr = list_construct_capacity(size);
+    int i;
+
+    set_comp(list_ptr, bench_comp);
+    for(i = 0; i < size; i++)
+        list_insert(list_ptr, new_elem(values[i]), list_iter_tail(list_ptr));
+    return list_ptr;
+}
+
+/* Number of times an operation doing work steps is repeated */
+static int repeats(double work)
+{
+    return work < BENCH_MIN_WORK ? BENCH_MIN_WORK / work : 1;
+}
+
+static void report(const char *op, const char *variant, input_t input,
+        int size, double ns, double ops)
+{
+    printf("%s,%s,%s,%d,%.2f,%.2f\n", op, variant, input_names[input], size,
+            ns / ops, compares / ops);
+}
+
+static void sort_recursive_select(List list_ptr)
+{
+    recursive_select_sort(list_ptr, list_iter_first(list_ptr),
+            list_iter_tail(list_ptr));
+}
+
+static void sort_iter_select(List list_ptr)
+{
+    iter_select_sort(list_ptr, list_iter_first(list_ptr),
+            list_iter_tail(list_ptr));
+}
+
+static void sort_parallel(List list_ptr)
+{
+    set_comp(list_ptr, bench_comp_atomic);
+    list_sort_parallel(list_ptr, BENCH_THREADS);
+}
+
+static list_key_t bench_key(void *elem)
+{
+    list_key_t key;
+
+    key.i32 = *(int *) elem;
+    return key;
+}
+
+static void sort_by_key(List list_ptr)
+{
+    list_sort_by_key(list_ptr, bench_key, LIST_KEY_INT32);
+}
+
+static void bench_sorts(input_t input, int *values, int size)
+{
+    struct {
+        const char *name;
+        void (*sort)(List);
+        int quadratic;
+    } sorts[] = {
+        { "insert_sort", insert_sort, 1 },
+        { "recursive_select_sort", sort_recursive_select, 1 },
+        { "iter_select_sort", sort_iter_select, 1 },
+        { "merge_sort", merge_sort, 0 },
+        { "natural_sort", natural_sort, 0 },
+        { "list_sort", list_sort, 0 },
+        { "list_sort_array", list_sort_array, 0 },
+        { "list_sort_parallel", sort_parallel, 0 },
+        { "list_sort_by_key", sort_by_key, 0 },
+    };
+    List list_ptr;
+    double ns;
+    int i, r, reps;
+
+    for(i = 0; i < sizeof(sorts) / sizeof(sorts[0]); i++)
+    {
+        if(sorts[i].quadratic && size > BENCH_QUADRATIC_MAX)
+            continue;
+
+        reps = repeats(sorts[i].quadratic ? (double) size * size : size);
+        ns = 0;
+        compares = 0;
+        for(r = 0; r < reps; r++)
+        {
+            list_ptr = build_list(values, size);
+            ns -= now_ns();
+            sorts[i].sort(list_ptr);
+            ns += now_ns();
+            list_destruct(list_ptr);
+        }
+        report("sort", sorts[i].name, input, size, ns, (double) size * reps);
+    }
+}
+
+/* LIST_DEFINE and LIST_DEFINE_COMPACT lists of ints, built, sorted and
+ * searched the way the generic list is by bench_insert, bench_sorts and
+ * bench_find.  Their comparisons are compiled in and not counted.
+ */
+static void bench_typed(input_t input, int *values, int size)
+{
+    intlist_t *typed;
+    intcompact_t *compact;
+    double ns[6] = { 0, 0, 0, 0, 0, 0 };
+    int i, r, reps = repeats(size), probes;
+
+    compares = 0;
+    for(r = 0; r < reps; r++)
+    {
+        typed = intlist_construct();
+        ns[0] -= now_ns();
+        for(i = 0; i < size; i++)
+            intlist_insert(typed, values[i], intlist_iter_tail(typed));
+        ns[0] += now_ns();
+
+        ns[1] -= now_ns();
+        intlist_sort(typed);
+        ns[1] += now_ns();
+        intlist_destruct(typed);
+
+        compact = intcompact_construct();
+        ns[3] -= now_ns();
+        for(i = 0; i < size; i++)
+            intcompact_insert(compact, values[i], intcompact_iter_tail(compact));
+        ns[3] += now_ns();
+
+        ns[4] -= now_ns();
+        intcompact_sort(compact);
+        ns[4] += now_ns();
+        intcompact_destruct(compact);
+    }
+    report("list_insert", "typed", input, size, ns[0], (double) size * reps);
+    report("sort", "typed", input, size, ns[1], (double) size * reps);
+    report("list_insert", "typed_compact", input, size, ns[3],
+            (double) size * reps);
+    report("sort", "typed_compact", input, size, ns[4], (double) size * reps);
+
+    //Unsorted, as bench_find searches the generic list
+    typed = intlist_construct();
+    compact = intcompact_construct();
+    for(i = 0; i < size; i++)
+    {
+        intlist_insert(typed, values[i], intlist_iter_tail(typed));
+        intcompact_insert(compact, values[i], intcompact_iter_tail(compact));
+    }
+    probes = repeats(size) * BENCH_PROBES;
+    if(probes > BENCH_MIN_WORK)
+        probes = BENCH_MIN_WORK;
+    ns[2] = -now_ns();
+    for(i = 0; i < probes; i++)
+        sink += intlist_elem_find(typed, values[rand() % size]) != NULL;
+    ns[2] += now_ns();
+    ns[5] = -now_ns();
+    for(i = 0; i < probes; i++)
+        sink += intcompact_elem_find(compact, values[rand() % size]) != 0;
+    ns[5] += now_ns();
+    report("list_elem_find", "typed", input, size, ns[2], probes);
+    report("list_elem_find", "typed_compact", input, size, ns[5], probes);
+    intlist_destruct(typed);
+    intcompact_destruct(compact);
+}
+
+static void bench_insert(input_t input, int *values, int size)
+{
+    List list_ptr;
+    double ns_tail = 0, ns_head = 0;
+    int i, r, reps = repeats(size);
+
+    compares = 0;
+    for(r = 0; r < reps; r++)
+    {
+        list_ptr = list_construct();
+        ns_tail -= now_ns();
+        for(i = 0; i < size; i++)
+            list_insert(list_ptr, new_elem(values[i]), list_iter_tail(list_ptr));
+        ns_tail += now_ns();
+        list_destruct(list_ptr);
+
+        list_ptr = list_construct();
+        ns_head -= now_ns();
+        for(i = 0; i < size; i++)
+            list_insert(list_ptr, new_elem(values[i]), list_iter_first(list_ptr));
+        ns_head += now_ns();
+        list_destruct(list_ptr);
+    }
+    report("list_insert", "tail", input, size, ns_tail, (double) size * reps);
+    report("list_insert", "head", input, size, ns_head, (double) size * reps);
+}
+
+static void bench_insert_sorted(input_t input, int *values, int size)
+{
+    List list_ptr;
+    double ns;
+    int i, r, skip, reps;
+
+    for(skip = 0; skip <= 1; skip++)
+    {
+        if(!skip && size > BENCH_QUADRATIC_MAX)
+            continue;
+
+        reps = repeats(skip ? size : (double) size * size);
+        ns = 0;
+        compares = 0;
+        for(r = 0; r < reps; r++)
+        {
+            list_ptr = list_construct();
+            set_comp(list_ptr, bench_comp);
+            list_use_skip_index(list_ptr, skip);
+            ns -= now_ns();
+            for(i = 0; i < size; i++)
+                list_insert_sorted(list_ptr, new_elem(values[i]));
+            ns += now_ns();
+            list_destruct(list_ptr);
+        }
+        report("list_insert_sorted", skip ? "skip_index" : "plain", input,
+                size, ns, (double) size * reps);
+    }
+}
+
+static void bench_find(input_t input, int *values, int size)
+{
+    List list_ptr = build_list(values, size);
+    double ns;
+    int i, probes;
+
+    //Each probe scans half of the list on average
+    probes = repeats(size) * BENCH_PROBES;
+    if(probes > BENCH_MIN_WORK)
+        probes = BENCH_MIN_WORK;
+
+    compares = 0;
+    ns = -now_ns();
+    for(i = 0; i < probes; i++)
+        list_elem_find(list_ptr, &values[rand() % size]);
+    ns += now_ns();
+    report("list_elem_find", "hit", input, size, ns, probes);
+
+    //With a key column, which the same scans go through with vector compares
+    set_key_column(list_ptr, bench_key, LIST_KEY_INT32);
+    list_elem_find(list_ptr, &values[0]);
+    compares = 0;
+    ns = -now_ns();
+    for(i = 0; i < probes; i++)
+        list_elem_find(list_ptr, &values[rand() % size]);
+    ns += now_ns();
+    report("list_elem_find", "key_column", input, size, ns, probes);
+
+    ns = -now_ns();
+    for(i = 0; i < probes; i++)
+        sink += list_key_count(list_ptr, bench_key(&values[rand() % size]),
+                bench_key(&values[rand() % size]));
+    ns += now_ns();
+    report("list_key_count", "key_column", input, size, ns, probes);
+    set_key_column(list_ptr, NULL, LIST_KEY_INT32);
+
+    //With a hash index, built by the first call
+    set_hash(list_ptr, bench_hash);
+    list_elem_find(list_ptr, &values[0]);
+    probes = BENCH_MIN_WORK;
+    compares = 0;
+    ns = -now_ns();
+    for(i = 0; i < probes; i++)
+        list_elem_find(list_ptr, &values[rand() % size]);
+    ns += now_ns();
+    report("list_elem_find", "hash", input, size, ns, probes);
+    list_destruct(list_ptr);
+}
+
+static void bench_at(input_t input, int *values, int size)
+{
+    List list_ptr = build_list(values, size);
+    double ns;
+    int i;
+
+    //The first call builds the index
+    compares = 0;
+    ns = -now_ns();
+    list_at(list_ptr, 0);
+    ns += now_ns();
+    report("list_at", "build", input, size, ns, size);
+
+    ns = -now_ns();
+    for(i = 0; i < BENCH_MIN_WORK; i++)
+        list_at(list_ptr, rand() % size);
+    ns += now_ns();
+    report("list_at", "random", input, size, ns, BENCH_MIN_WORK);
+    list_destruct(list_ptr);
+}
+
+/* Walks the list without touching the elements, with the nodes in the order
+ * a relinking sort leaves them and again after list_compact.
+ */
+static void bench_scan(input_t input, int *values, int size)
+{
+    List list_ptr = build_list(values, size);
+    Iterator idx_ptr;
+    double ns[2];
+    long found = 0;
+    int pass, r, reps = repeats(size);
+
+    merge_sort(list_ptr);
+    compares = 0;
+    for(pass = 0; pass < 2; pass++)
+    {
+        if(pass == 1)
+            list_compact(list_ptr);
+        ns[pass] = -now_ns();
+        for(r = 0; r < reps; r++)
+        {
+            for(idx_ptr = list_iter_first(list_ptr); idx_ptr != list_iter_tail(list_ptr);
+                    idx_ptr = list_iter_next(idx_ptr))
+                found += list_access(list_ptr, idx_ptr) == values;
+        }
+        ns[pass] += now_ns();
+    }
+    sink = found;
+    report("list_scan", "scattered", input, size, ns[0], (double) size * reps);
+    report("list_scan", "compact", input, size, ns[1], (double) size * reps);
+    list_destruct(list_ptr);
+}
+
+/* The parallel traversals on one thread and on BENCH_THREADS threads, with
+ * list_filter also against removing the same elements one by one.  The
+ * list_foreach visitor only reads the elements; list_map_inplace rewrites
+ * them with the same work.
+ */
+static void bench_foreach(input_t input, int *values, int size)
+{
+    List list_ptr, removed;
+    Iterator idx_ptr;
+    unsigned int acc, hits = 0;
+    double ns[4];
+    int t, threads, r, reps = repeats((double) size * BENCH_VISIT_WORK / 8);
+
+    compares = 0;
+    for(t = 0; t < 2; t++)
+    {
+        threads = t == 0 ? 1 : BENCH_THREADS;
+        ns[0] = ns[1] = ns[2] = ns[3] = 0;
+        for(r = 0; r < reps; r++)
+        {
+            list_ptr = build_list(values, size);
+            ns[0] -= now_ns();
+            list_foreach(list_ptr, bench_visit, &hits, threads);
+            ns[0] += now_ns();
+            sink += hits;
+
+            ns[3] -= now_ns();
+            list_map_inplace(list_ptr, bench_map, NULL, threads);
+            ns[3] += now_ns();
+
+            acc = 0;
+            ns[1] -= now_ns();
+            list_reduce(list_ptr, &acc, sizeof(acc), bench_reduce, bench_combine,
+                    NULL, threads);
+            ns[1] += now_ns();
+            sink = acc;
+
+            ns[2] -= now_ns();
+            removed = list_filter(list_ptr, bench_keep, NULL, threads);
+            ns[2] += now_ns();
+            list_destruct(removed);
+            list_destruct(list_ptr);
+        }
+        report("list_foreach", t == 0 ? "serial" : "parallel", input, size,
+                ns[0], (double) size * reps);
+        report("list_map_inplace", t == 0 ? "serial" : "parallel", input,
+                size, ns[3], (double) size * reps);
+        report("list_reduce", t == 0 ? "serial" : "parallel", input, size,
+                ns[1], (double) size * reps);
+        report("list_filter", t == 0 ? "serial" : "parallel", input, size,
+                ns[2], (double) size * reps);
+    }
+
+    ns[0] = 0;
+    for(r = 0; r < reps; r++)
+    {
+        list_ptr = build_list(values, size);
+        ns[0] -= now_ns();
+        idx_ptr = list_iter_first(list_ptr);
+        while(idx_ptr != list_iter_tail(list_ptr))
+        {
+            idx_ptr = list_iter_next(idx_ptr);
+            if(!bench_keep(idx_ptr->prev->data_ptr, NULL))
+                free(list_remove(list_ptr, idx_ptr->prev));
+        }
+        ns[0] += now_ns();
+        list_destruct(list_ptr);
+    }
+    report("list_filter", "remove_loop", input, size, ns[0],
+            (double) size * reps);
+}
+
+/* Pushes all values into a priority queue and pops them all again, with a
+ * PQueue and with a sorted List used as one.  An op is one push and pop.
+ */
+static void bench_pq(input_t input, int *values, int size)
+{
+    PQueue pq;
+    List list_ptr;
+    double ns;
+    int i, r, skip, reps = repeats(size);
+
+    ns = 0;
+    compares = 0;
+    for(r = 0; r < reps; r++)
+    {
+        pq = pq_construct();
+        pq_set_comp(pq, bench_comp);
+        ns -= now_ns();
+        for(i = 0; i < size; i++)
+            pq_push(pq, new_elem(values[i]));
+        for(i = 0; i < size; i++)
+            free(pq_pop(pq));
+        ns += now_ns();
+        pq_destruct(pq);
+    }
+    report("pq", "pairing_heap", input, size, ns, (double) size * reps);
+
+    for(skip = 0; skip <= 1; skip++)
+    {
+        if(!skip && size > BENCH_QUADRATIC_MAX)
+            continue;
+
+        reps = repeats(skip ? size : (double) size * size);
+        ns = 0;
+        compares = 0;
+        for(r = 0; r < reps; r++)
+        {
+            list_ptr = list_construct();
+            set_comp(list_ptr, bench_comp);
+            list_use_skip_index(list_ptr, skip);
+            ns -= now_ns();
+            for(i = 0; i < size; i++)
+                list_insert_sorted(list_ptr, new_elem(values[i]));
+            for(i = 0; i < size; i++)
+                free(list_remove(list_ptr, list_iter_first(list_ptr)));
+            ns += now_ns();
+            list_destruct(list_ptr);
+        }
+        report("pq", skip ? "list_skip_index" : "list", input, size, ns,
+                (double) size * reps);
+    }
+}
+
+/* The top BENCH_TOP_K elements and the median, found without sorting the
+ * whole list.  An op is one element of the list.
+ */
+static void bench_select(input_t input, int *values, int size)
+{
+    List list_ptr;
+    double ns[3] = { 0, 0, 0 };
+    long counted[3] = { 0, 0, 0 };
+    int r, reps = repeats(size);
+
+    for(r = 0; r < reps; r++)
+    {
+        list_ptr = build_list(values, size);
+        compares = 0;
+        ns[0] -= now_ns();
+        list_partial_sort(list_ptr, BENCH_TOP_K);
+        ns[0] += now_ns();
+        counted[0] += compares;
+        list_destruct(list_ptr);
+
+        list_ptr = build_list(values, size);
+        compares = 0;
+        ns[1] -= now_ns();
+        list_nth_element(list_ptr, size / 2);
+        ns[1] += now_ns();
+        counted[1] += compares;
+        list_destruct(list_ptr);
+
+        //What it took before: sort everything, then walk to the median
+        list_ptr = build_list(values, size);
+        compares = 0;
+        ns[2] -= now_ns();
+        list_sort(list_ptr);
+        list_at(list_ptr, size / 2);
+        ns[2] += now_ns();
+        counted[2] += compares;
+        list_destruct(list_ptr);
+    }
+    compares = counted[0];
+    report("list_partial_sort", "top_k", input, size, ns[0], (double) size * reps);
+    compares = counted[1];
+    report("list_nth_element", "median", input, size, ns[1], (double) size * reps);
+    compares = counted[2];
+    report("list_nth_element", "full_sort", input, size, ns[2], (double) size * reps);
+}
+
+/* list_save, and getting the saved list back with list_open_mmap, both
+ * just mapping it and walking it as well, against building it again one
+ * list_insert at a time.  The file stays in the page cache between saving
+ * and opening, so the open and walk times leave out reading the disk.
+ */
+static void bench_save(input_t input, int *values, int size)
+{
+    List list_ptr;
+    ListView view;
+    ViewIter idx_ptr;
+    double ns[4] = { 0, 0, 0, 0 };
+    long sum;
+    int saved, r, reps = repeats((double) size * BENCH_SAVE_WORK);
+
+    for(r = 0; r < reps; r++)
+    {
+        list_ptr = build_list(values, size);
+        ns[0] -= now_ns();
+        saved = list_save(list_ptr, BENCH_SAVE_PATH, bench_serialize);
+        ns[0] += now_ns();
+        assert(saved == 0);
+        list_destruct(list_ptr);
+
+        ns[1] -= now_ns();
+        view = list_open_mmap(BENCH_SAVE_PATH);
+        ns[1] += now_ns();
+        assert(view != NULL);
+        list_view_close(view);
+
+        ns[2] -= now_ns();
+        view = list_open_mmap(BENCH_SAVE_PATH);
+        sum = 0;
+        for(idx_ptr = list_view_first(view); idx_ptr != NULL;
+                idx_ptr = list_view_next(view, idx_ptr))
+            sum += *(int *) list_view_access(view, idx_ptr, NULL);
+        ns[2] += now_ns();
+        sink = sum;
+        list_view_close(view);
+
+        ns[3] -= now_ns();
+        list_ptr = build_list(values, size);
+        ns[3] += now_ns();
+        list_destruct(list_ptr);
+    }
+    remove(BENCH_SAVE_PATH);
+    compares = 0;
+    report("list_save", "file", input, size, ns[0], (double) size * reps);
+    report("list_open_mmap", "open", input, size, ns[1], (double) size * reps);
+    report("list_open_mmap", "open_walk", input, size, ns[2],
+            (double) size * reps);
+    report("list_open_mmap", "rebuild", input, size, ns[3],
+            (double) size * reps);
+}
+
+/* Builds a sorted list from every step-th value starting at offset */
+static List build_sorted(int *values, int size, int offset, int step)
+{
+    List list_ptr = list_construct();
+    int i;
+
+    set_comp(list_ptr, bench_comp);
+    for(i = offset; i < size; i += step)
+        list_insert(list_ptr, new_elem(values[i]), list_iter_tail(list_ptr));
+    list_sort(list_ptr);
+    return list_ptr;
+}
+
+/* The set algebra on two sorted lists holding the even and the odd
+ * positions of values, with list_intersect also done the way it had to be
+ * before, by a list_elem_find per element.  An op is one element of the
+ * lists, and the lists are built again for every measurement.
+ */
+static void bench_set(input_t input, int *values, int size)
+{
+    const char *names[] = {
+        "list_merge_sorted", "list_union", "list_intersect",
+        "list_difference", "list_unique", "list_merge_many", "find_loop"
+    };
+    List lists[BENCH_SET_LISTS], removed;
+    Iterator idx_ptr, next;
+    double ns;
+    long counted;
+    int op, i, r, reps = repeats(size);
+
+    for(op = 0; op < sizeof(names) / sizeof(names[0]); op++)
+    {
+        if(op == 6 && size > BENCH_QUADRATIC_MAX)
+            continue;
+        if(op == 6)
+            reps = repeats((double) size * size);
+
+        ns = 0;
+        counted = 0;
+        for(r = 0; r < reps; r++)
+        {
+            for(i = 0; i < BENCH_SET_LISTS; i++)
+                lists[i] = build_sorted(values, size, i % 2,
+                        op == 5 ? BENCH_SET_LISTS : 2);
+            removed = NULL;
+            compares = 0;
+            ns -= now_ns();
+            switch(op)
+            {
+            case 0:
+                list_merge_sorted(lists[0], lists[1]);
+                break;
+            case 1:
+                list_union(lists[0], lists[1]);
+                break;
+            case 2:
+                removed = list_intersect(lists[0], lists[1]);
+                break;
+            case 3:
+                removed = list_difference(lists[0], lists[1]);
+                break;
+            case 4:
+                removed = list_unique(lists[0]);
+                break;
+            case 5:
+                list_merge_many(lists, BENCH_SET_LISTS);
+                break;
+            default:
+                for(idx_ptr = list_iter_first(lists[0]);
+                        idx_ptr != list_iter_tail(lists[0]); idx_ptr = next)
+                {
+                    next = list_iter_next(idx_ptr);
+                    if(list_elem_find(lists[1], list_access(lists[0], idx_ptr)) == NULL)
+                        free(list_remove(lists[0], idx_ptr));
+                }
+                break;
+            }
+            ns += now_ns();
+            counted += compares;
+            if(removed != NULL)
+                list_destruct(removed);
+            for(i = 0; i < BENCH_SET_LISTS; i++)
+                list_destruct(lists[i]);
+        }
+        compares = counted;
+        report(names[op], "sorted", input, size, ns, (double) size * reps);
+    }
+}
+
+static void bench_remove(input_t input, int *values, int size)
+{
+    List list_ptr;
+    Iterator idx_ptr;
+    double ns_front = 0, ns_alternate = 0;
+    int r, reps = repeats(size);
+
+    compares = 0;
+    for(r = 0; r < reps; r++)
+    {
+        list_ptr = build_list(values, size);
+        ns_front -= now_ns();
+        while(list_size(list_ptr) > 0)
+            free(list_remove(list_ptr, list_iter_first(list_ptr)));
+        ns_front += now_ns();
+        list_destruct(list_ptr);
+
+        //Every other element, walking the list like a filter would
+        list_ptr = build_list(values, size);
+        ns_alternate -= now_ns();
+        idx_ptr = list_iter_first(list_ptr);
+        while(idx_ptr != list_iter_tail(list_ptr))
+        {
+            idx_ptr = list_iter_next(idx_ptr);
+            free(list_remove(list_ptr, idx_ptr->prev));
+            if(idx_ptr != list_iter_tail(list_ptr))
+                idx_ptr = list_iter_next(idx_ptr);
+        }
+        ns_alternate += now_ns();
+        list_destruct(list_ptr);
+    }
+    report("list_remove", "front", input, size, ns_front, (double) size * reps);
+    report("list_remove", "alternate", input, size, ns_alternate,
+            (double) (size + 1) / 2 * reps);
+}
+
+static void bench_destruct(input_t input, int *values, int size)
+{
+    List list_ptr;
+    double ns = 0;
+    int r, reps = repeats(size);
+
+    compares = 0;
+    for(r = 0; r < reps; r++)
+    {
+        list_ptr = build_list(values, size);
+        ns -= now_ns();
+        list_destruct(list_ptr);
+        ns += now_ns();
+    }
+    report("list_destruct", "all", input, size, ns, (double) size * reps);
+}
+
+/* One producer or consumer thread of bench_queue.  The items are an array of
+ * ints, producer p pushing pointers to items [p * per, (p + 1) * per) in
+ * order; consumers pop until all items were counted.
+ */
+typedef struct queue_worker_tag {
+    ListQueue queue_ptr;        /* NULL for the mutex guarded list */
+    List list_ptr;
+    pthread_mutex_t *lock;
+    int *items;
+    char *seen;
+    int producer;               /* -1 for consumers */
+    int producers;
+    int per;
+    int *consumed;
+} queue_worker_t;
+
+static void queue_put(queue_worker_t *w, void *elem)
+{
+    if(w->queue_ptr != NULL)
+    {
+        list_queue_push(w->queue_ptr, elem);
+        return;
+    }
+    pthread_mutex_lock(w->lock);
+    list_insert(w->list_ptr, elem, list_iter_tail(w->list_ptr));
+    pthread_mutex_unlock(w->lock);
+}
+
+static void *queue_get(queue_worker_t *w)
+{
+    void *elem = NULL;
+
+    if(w->queue_ptr != NULL)
+        return list_queue_pop(w->queue_ptr);
+    pthread_mutex_lock(w->lock);
+    if(list_size(w->list_ptr) > 0)
+        elem = list_remove(w->list_ptr, list_iter_first(w->list_ptr));
+    pthread_mutex_unlock(w->lock);
+    return elem;
+}
+
+static void *queue_work(void *arg)
+{
+    queue_worker_t *w = (queue_worker_t *) arg;
+    int last[BENCH_THREADS];
+    int i, item, total = w->producers * w->per;
+    int *elem;
+
+    if(w->producer >= 0)
+    {
+        for(i = 0; i < w->per; i++)
+            queue_put(w, &w->items[w->producer * w->per + i]);
+        return NULL;
+    }
+
+    for(i = 0; i < w->producers; i++)
+        last[i] = -1;
+    while(__atomic_load_n(w->consumed, __ATOMIC_RELAXED) < total)
+    {
+        elem = (int *) queue_get(w);
+        if(elem == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+        item = *elem;
+        assert(item > last[item / w->per] && w->seen[item] == 0);
+        last[item / w->per] = item;
+        w->seen[item] = 1;
+        __atomic_add_fetch(w->consumed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* Passes size items (at least BENCH_MIN_WORK) from producers to consumers
+ * through a ListQueue and through a mutex guarded List.
+ */
+static void bench_queue(int size)
+{
+    struct {
+        const char *name;
+        int producers;
+        int consumers;
+    } shapes[] = {
+        { "spsc", 1, 1 },
+        { "mpsc", BENCH_THREADS, 1 },
+        { "mpmc", BENCH_THREADS, BENCH_THREADS },
+    };
+    queue_worker_t workers[2 * BENCH_THREADS];
+    pthread_t threads[2 * BENCH_THREADS];
+    int started[2 * BENCH_THREADS];
+    ListQueue queue_ptr;
+    List list_ptr;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    char variant[32];
+    int items_count = size < BENCH_MIN_WORK ? BENCH_MIN_WORK : size;
+    int *items;
+    char *seen;
+    int i, s, locked, nthreads, per, consumed;
+    double ns;
+
+    if(items_count > BENCH_QUEUE_ITEMS)
+        items_count = BENCH_QUEUE_ITEMS;
+    items = (int *) malloc(items_count * sizeof(int));
+    seen = (char *) malloc(items_count);
+    for(i = 0; i < items_count; i++)
+        items[i] = i;
+
+    compares = 0;
+    for(s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        for(locked = 0; locked <= 1; locked++)
+        {
+            per = items_count / shapes[s].producers;
+            nthreads = shapes[s].producers + shapes[s].consumers;
+            memset(seen, 0, items_count);
+            consumed = 0;
+            queue_ptr = locked ? NULL : list_queue_construct();
+            list_ptr = locked ? list_construct() : NULL;
+            for(i = 0; i < nthreads; i++)
+            {
+                workers[i].queue_ptr = queue_ptr;
+                workers[i].list_ptr = list_ptr;
+                workers[i].lock = &lock;
+                workers[i].items = items;
+                workers[i].seen = seen;
+                workers[i].producer = i < shapes[s].producers ? i : -1;
+                workers[i].producers = shapes[s].producers;
+                workers[i].per = per;
+                workers[i].consumed = &consumed;
+            }
+
+            ns = -now_ns();
+            for(i = 0; i < nthreads; i++)
+                started[i] = pthread_create(&threads[i], NULL, queue_work,
+                        &workers[i]) == 0;
+            for(i = 0; i < nthreads; i++)
+            {
+                assert(started[i]);
+                pthread_join(threads[i], NULL);
+            }
+            ns += now_ns();
+
+            for(i = 0; i < per * shapes[s].producers; i++)
+                assert(seen[i] == 1);
+            if(locked)
+            {
+                assert(list_size(list_ptr) == 0);
+                list_destruct(list_ptr);
+            }
+            else
+            {
+                assert(list_queue_pop(queue_ptr) == NULL);
+                list_queue_destruct(queue_ptr);
+            }
+            snprintf(variant, sizeof(variant), "%s_%s",
+                    locked ? "mutex" : "lockfree", shapes[s].name);
+            report("queue", variant, INPUT_SORTED, size, ns,
+                    (double) per * shapes[s].producers);
+        }
+    }
+    free(items);
+    free(seen);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_size = BENCH_DEFAULT_MAX;
+    int *values;
+    int size, input;
+
+    if(argc > 1)
+        max_size = atoi(argv[1]);
+
+    printf("op,variant,input,size,ns_per_op,compares_per_op\n");
+    for(size = BENCH_MIN_SIZE; size <= max_size; size *= 10)
+    {
+        values = (int *) malloc(size * sizeof(int));
+        for(input = INPUT_RANDOM; input < INPUTS; input++)
+        {
+            srand(size);
+            fill_values(input, size, values);
+            bench_insert(input, values, size);
+            bench_insert_sorted(input, values, size);
+            bench_find(input, values, size);
+            bench_at(input, values, size);
+            bench_scan(input, values, size);
+            bench_foreach(input, values, size);
+            bench_pq(input, values, size);
+            bench_set(input, values, size);
+            bench_select(input, values, size);
+            bench_save(input, values, size);
+            bench_remove(input, values, size);
+            bench_destruct(input, values, size);
+            bench_sorts(input, values, size);
+            bench_typed(input, values, size);
+            fflush(stdout);
+        }
+        bench_queue(size);
+        fflush(stdout);
+        free(values);
+    }
+    return 0;
+}
+
+/* commands for vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -3,25 +3,557 @@
  *A two-way linked list ADT along with some sorting features
 */
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(LIST_NO_SIMD)
+#define KEYS_X86                /* key column scans use SSE and AVX2 */
+#include <immintrin.h>
+#endif
 #include "list.h"        /* defines public functions for list ADT */
 
 /* definitions for private constants used in list.c only */
 
 #define SORTED_LIST   -123456
 #define UNSORTED_LIST -621354
+
+#define MERGE_BINS    64        /* merge_sort bins, enough for 2^64 nodes */
+#define RUN_STACK     128       /* natural_sort runs, enough for 2^64 nodes */
+#define MIN_GALLOP    7         /* wins in a row before a merge gallops */
+#define MIN_RUN       32        /* shorter natural runs are extended */
+
+#define ARRAY_SORT_MIN       2048   /* list_sort gathers lists this long */
+#define ARRAY_SORT_RUN       32     /* runs insertion sorted before merging */
+#define SORTED_PROBE         4096   /* elements list_sort looks at for runs */
+#define RADIX_STRING_MIN     32     /* string buckets insertion sorted below this */
+
+#define PARALLEL_SORT_MIN    65536  /* smaller lists are sorted serially */
+#define PARALLEL_SEGMENT_MIN 16384  /* fewest nodes handed to one thread */
+#define PARALLEL_MAX_THREADS 64
+#define PARALLEL_VISIT_MIN   256    /* fewest nodes list_foreach hands a thread */
+#define VISIT_PREFETCH       8      /* nodes a visit prefetches ahead */
+
+#define SKIP_MAX_LEVEL 32     /* tower height limit of the skip list index */
+#define SKIP_FANOUT    4      /* one in SKIP_FANOUT entries is promoted */
+
+#define RANK_WALK     32     /* lists this short are walked, not indexed */
+#define RANK_IDLE_MIN 1024   /* updates an unused order index survives */
+#define RANK_CHUNK    256    /* order index nodes allocated at a time */
+
+#define HASH_MIN_SLOTS 16     /* smallest hash index table */
+
+#define KEYS_MIN_SLOTS 16     /* smallest key column */
+
+#define QUEUE_HAZARDS    2      /* hazard pointers a queue operation needs */
+#define QUEUE_RETIRE_MIN 64     /* retired nodes a thread keeps before a scan */
+#define QUEUE_LINE       64     /* cache line, kept to one writer where it helps */
+
+#define POOL_MIN_SLAB 16        /* nodes in the first slab of a pool */
+#define POOL_MAX_SLAB 65536     /* slabs double in size up to this many nodes */
+
+#define VIEW_MAGIC    "LISTVIEW"  /* first bytes of a complete list_save file */
+#define VIEW_VERSION  1
+#define VIEW_ALIGN    8         /* records and element bytes start aligned */
+#define VIEW_TMP      ".tmp"    /* suffix of the file list_save writes first */
 //static int (*comp_proc)(void *, void *);
 
+/* Performance counters
+ *
+ * With LIST_STATS defined, every call of a comparison function goes through
+ * COMPARE, which counts it in a per thread counter.  Public operations take
+ * the difference of that counter between STATS_BEGIN and STATS_END and add it
+ * to the list they work on, so sorts that run on several threads still count
+ * every comparison once.  Without LIST_STATS all of this expands to nothing.
+ */
+#ifdef LIST_STATS
+typedef struct stats_begin_tag {
+    unsigned long long compares;
+    double start_ns;            /* 0 unless the operation is being timed */
+} stats_begin_t;
+
+static __thread unsigned long long thread_compares;
+static stats_begin_t stats_begin_op(list_t *list_ptr, list_op_t op);
+static void stats_end_op(list_t *list_ptr, stats_begin_t *begin, list_op_t op);
+
+#define COMPARE(comp_proc, a, b)  (thread_compares++, (comp_proc)((a), (b)))
+#define STATS_ADD(L, field, n)    ((L)->stats.field += (n))
+#define STATS_BEGIN(L, op)        stats_begin_t stats_begin = stats_begin_op((L), (op))
+#define STATS_END(L, op)          stats_end_op((L), &stats_begin, (op))
+#else
+#define COMPARE(comp_proc, a, b)  (comp_proc)((a), (b))
+#define STATS_ADD(L, field, n)    ((void) 0)
+#define STATS_BEGIN(L, op)
+#define STATS_END(L, op)          ((void) 0)
+#endif
+
+/* a slab is one contiguous block of nodes owned by a pool */
+typedef struct list_slab_tag {
+    struct list_slab_tag *next;
+    int node_count;
+    int nodes_used;
+    list_node_t nodes[];
+} list_slab_t;
+
+typedef struct list_pool_tag {
+    list_slab_t *slabs;         /* newest slab first */
+    list_node_t *free_nodes;
+    int next_slab_size;
+    int ref_count;              /* lists using the pool, and pools merged into it */
+    struct list_pool_tag *merged_into;
+} list_pool_t;
+
+/* one unit of work for list_sort_parallel: sorts chain_l when chain_r is
+ * NULL, otherwise merges the two sorted chains into result */
+typedef struct sort_task_tag {
+    comparer comp_proc;
+    list_node_t *chain_l;
+    list_node_t *chain_r;
+    list_node_t *result;
+    unsigned long long compares;    /* with LIST_STATS only */
+} sort_task_t;
+
+/* one slice of the node array of list_foreach, list_map_inplace,
+ * list_filter or list_reduce, with the callback of the operation set */
+typedef struct visit_task_tag {
+    list_node_t **nodes;
+    int count;
+    visitor visit_proc;
+    mapper map_proc;
+    predicate keep_proc;
+    reducer reduce_proc;
+    void *arg;
+    char *keep;                 /* list_filter: nonzero for the kept nodes */
+    void *acc;                  /* list_reduce: the slice's accumulator */
+    size_t acc_size;
+} visit_task_t;
+
+/* Skip list index
+ *
+ * An optional skip list over a sorted list.  Only about one node in
+ * SKIP_FANOUT gets an entry, and each level above keeps about one entry in
+ * SKIP_FANOUT of the level below, so a search descends the levels and then
+ * finishes with a short walk along the list itself.  Entries appear in the
+ * same order as their nodes in the list.
+ *
+ * The index is only trusted while valid is set and the list is sorted.
+ * A list_insert that breaks the order merely clears valid, and the stale
+ * entries are thrown away and rebuilt when the list is sorted again.  One
+ * that keeps the order leaves the new node without an entry, which the
+ * search walks over like any other node between two entries.
+ */
+typedef struct skip_entry_tag {
+    list_node_t *node;
+    int levels;
+    struct skip_entry_tag *next[];
+} skip_entry_t;
+
+typedef struct list_skip_tag {
+    skip_entry_t *head;         /* sentinel with SKIP_MAX_LEVEL levels */
+    int levels;                 /* levels in use */
+    int valid;
+    unsigned int seed;
+} list_skip_t;
+
+/* Order statistic index
+ *
+ * A treap over the nodes of the list in list order, each tree node counting
+ * the nodes of its subtree, so the node at a position and the position of a
+ * node are both found in O(log n) expected time.  A hash table maps list
+ * nodes to their tree nodes.  The treap is built in O(n) the first time
+ * list_at or list_index_of is used, and kept up to date by single element
+ * inserts and removes.  Bulk changes and sorts free it, to be built again by
+ * the next positional call, and so does a run of more updates than the list
+ * had elements (plus RANK_IDLE_MIN) at the last positional call, so
+ * lists that are not accessed by position stop paying for the index.
+ */
+typedef struct rank_node_tag {
+    list_node_t *node;
+    struct rank_node_tag *parent;
+    struct rank_node_tag *left;
+    struct rank_node_tag *right;    /* threads the free list */
+    unsigned int priority;          /* max-heap ordered */
+    int size;                       /* tree nodes in this subtree */
+} rank_node_t;
+
+typedef struct rank_chunk_tag {
+    struct rank_chunk_tag *next;
+    int used;
+    int count;
+    rank_node_t nodes[];
+} rank_chunk_t;
+
+typedef struct list_rank_tag {
+    rank_node_t *root;
+    rank_node_t **slots;        /* open addressing, list node to tree node */
+    size_t slot_mask;
+    int count;                  /* tree nodes in use */
+    rank_node_t *free_nodes;
+    rank_chunk_t *chunks;
+    int idle;                   /* updates left until the index is freed */
+    unsigned int seed;
+} list_rank_t;
+
+/* Hash index
+ *
+ * An optional open addressing hash table, keyed by the user's hash of the
+ * elements, with one slot per group of elements that the comparison
+ * function ranks as equal.  A slot holds the first node of its group in list
+ * order, which is what list_elem_find returns, and the number of nodes in the
+ * group.  The hash is kept next to them, so probes and moves within the
+ * table do not call the hash function again.  The nodes of a group of more
+ * than one are linked in list order, from the last back round to the first,
+ * through a second table keyed by node, so that the group's next node is at
+ * hand when its first is removed.
+ *
+ * The index is kept up to date by single element inserts and removes; bulk
+ * changes and sorts, which may move elements between nodes, mark it stale,
+ * and the next list_elem_find rebuilds it.
+ */
+typedef struct hash_member_tag {
+    list_node_t *node;          /* NULL if the slot is free */
+    list_node_t *prev;          /* neighbours within the group */
+    list_node_t *next;
+} hash_member_t;
+
+typedef struct list_hash_tag {
+    hasher hash_proc;
+    list_node_t **slots;        /* first node of each group, NULL if free */
+    unsigned long *hashes;      /* hash of the elements of each group */
+    int *sizes;                 /* nodes in each group */
+    size_t slot_mask;
+    int count;                  /* groups */
+    int valid;
+    hash_member_t *members;     /* nodes of groups of more than one, or NULL */
+    size_t member_mask;
+    int member_count;
+} list_hash_t;
+
+/* Key column
+ *
+ * An optional array of the integer keys of the elements, in list order, with
+ * the node of each key in a second array, so that list_elem_find and the
+ * range queries scan contiguous keys with vector compares instead of calling
+ * the comparison function on each node.  Keys are kept as 32 bit integers
+ * for LIST_KEY_INT32 and as 64 bit ones otherwise, unsigned keys with their
+ * top bit flipped so that signed compares order them.
+ *
+ * Entries in use run from start for count positions.  Appends at the back
+ * and removes at either end keep the column up to date; other inserts and
+ * removes, bulk changes and sorts mark it stale, and the next query rebuilds
+ * it.
+ */
+typedef struct list_keys_tag {
+    key_extractor key_proc;
+    list_key_kind_t kind;
+    size_t width;               /* bytes per key */
+    void *keys;
+    list_node_t **nodes;
+    int start;
+    int count;
+    int slots;
+    int valid;
+} list_keys_t;
+
+/* Concurrent queue
+ *
+ * A ListQueue is the Michael-Scott queue: a singly linked chain that starts
+ * at a dummy node, with producers linking new nodes after the last node and
+ * consumers swinging head to the next node, whose element they take and
+ * which becomes the new dummy.  Both ends move by compare and swap only, so
+ * no thread ever waits on another.
+ *
+ * A popped dummy may still be read by threads that loaded head before it
+ * moved, so it is retired rather than freed.  Each thread owns a hazard
+ * record in which it publishes the (at most QUEUE_HAZARDS) nodes it is about
+ * to dereference, and frees a retired node only once no record names it.
+ * Records are never freed; a thread's record is handed back for reuse when
+ * the thread exits, retired nodes and all.
+ */
+typedef struct queue_node_tag {
+    struct queue_node_tag *next;
+    void *data_ptr;
+} queue_node_t;
+
+typedef struct list_queue_tag {
+    queue_node_t *head __attribute__((aligned(QUEUE_LINE)));
+    queue_node_t *tail __attribute__((aligned(QUEUE_LINE)));
+} list_queue_t;
+
+typedef struct hazard_rec_tag {
+    void *hazards[QUEUE_HAZARDS];
+    struct hazard_rec_tag *next;    /* all records, newest first */
+    int active;                     /* owned by a live thread */
+    void **retired;                 /* nodes waiting to be freed */
+    size_t retired_count;
+    size_t retired_slots;
+} __attribute__((aligned(QUEUE_LINE))) hazard_rec_t;
+
+/* Priority queue
+ *
+ * A PQueue is a pairing heap: a tree in which every node precedes its
+ * children, kept as first child and next sibling links, so push and
+ * decrease-key are O(1) melds and pop-min is O(log n) amortized.  Each node
+ * carries the sequence number of its push, which breaks ties between
+ * elements of equal rank in push order.  Popped nodes are kept on a free
+ * list for later pushes.
+ */
+typedef struct list_pq_node_tag {
+    void *data_ptr;
+    unsigned long long seq;
+    struct list_pq_node_tag *child;     /* first child */
+    struct list_pq_node_tag *sibling;   /* next sibling */
+    struct list_pq_node_tag *prev;      /* parent of a first child, else
+                                           previous sibling; NULL at root */
+} list_pq_node_t;
+
+typedef struct list_pq_tag {
+    list_pq_node_t *root;
+    list_pq_node_t *free_nodes;         /* through sibling */
+    comparer comp_proc;
+    unsigned long long next_seq;
+    int size;
+} list_pq_t;
+
+/* the layout of a list_save file, see list_save; offsets count from the
+ * start of the file */
+typedef struct view_header_tag {
+    char magic[8];              /* VIEW_MAGIC once the file is complete */
+    uint32_t version;
+    uint32_t sorted;            /* 1 if the list was sorted */
+    uint64_t count;
+    uint64_t first;             /* records, 0 if there are none */
+    uint64_t last;
+    uint64_t file_size;
+} view_header_t;
+
+typedef struct list_view_rec_tag {
+    uint64_t next;              /* 0 after the last record */
+    uint64_t prev;              /* 0 before the first record */
+    uint64_t size;              /* element bytes, which follow the record */
+} view_rec_t;
+
+typedef struct list_view_tag {
+    char *base;                 /* the private mapping of the file */
+    size_t length;
+} list_view_t;
+
+static hazard_rec_t *hazard_records;
+static int hazard_record_count;
+static __thread hazard_rec_t *thread_hazards;
+static pthread_key_t hazard_key;
+static pthread_once_t hazard_once = PTHREAD_ONCE_INIT;
+
+/* a node of the list and its position, so that list_partial_sort and
+ * list_nth_element can order equal elements as a stable sort would */
+typedef struct select_entry_tag {
+    list_node_t *node;
+    int pos;
+} select_entry_t;
+
+/* an element and its key for list_sort_by_key: integer keys are mapped to
+ * unsigned ones that order the same way */
+typedef struct radix_entry_tag {
+    union {
+        unsigned long long u;
+        const unsigned char *s;
+    } key;
+    void *data_ptr;
+} radix_entry_t;
+
+/* a bucket of entries still to be sorted from string position depth on */
+typedef struct radix_range_tag {
+    int lo;
+    int hi;
+    size_t depth;
+} radix_range_t;
+
+/* a sorted run on the natural_sort stack, a NULL terminated chain */
+typedef struct run_tag {
+    list_node_t *first;
+    list_node_t *last;
+    int length;
+} run_t;
+
 /* prototypes for private functions used in list.c only */
 void list_debug_validate(list_t *L);
 void insert_sort(list_t *list_ptr);
 void recursive_select_sort(list_t *, Iterator, Iterator);
 void iter_select_sort(list_t *, Iterator, Iterator);
 void merge_sort(list_t *);
-list_t* split_list(list_t *);
-void merge(list_t *, list_t *);
+void natural_sort(list_t *);
 Iterator find_max(list_t *, Iterator, Iterator);
+static list_node_t *sort_chain(comparer comp_proc, list_node_t *chain);
+static list_node_t *merge_chains(comparer, list_node_t *, list_node_t *);
+static void relink_chain(list_t *list_ptr, list_node_t *chain);
+static void natural_merge_at(comparer comp_proc, run_t *runs, int i);
+static list_node_t *merge_runs(comparer comp_proc, list_node_t *chain_l,
+        list_node_t *chain_r, list_node_t **last);
+static int gallop_chain(comparer comp_proc, list_node_t *chain, void *key,
+        int strict, list_node_t **last_before);
+static int list_mostly_sorted(list_t *list_ptr);
+static int array_sort(list_t *list_ptr);
+static void array_insertion_sort(comparer comp_proc, void **elems, int count);
+static void array_merge(comparer comp_proc, void **src, int lo, int mid,
+        int hi, void **dst);
+static void *sort_task_run(void *task);
+static void run_workers(int nworkers, void *(*work)(void *), void *tasks,
+        size_t task_size);
+static int visit_run(list_t *list_ptr, visit_task_t *proto, int nthreads,
+        visit_task_t *tasks, list_node_t ***nodes);
+static void *visit_task_run(void *task);
+static list_pool_t *pool_create(int capacity_hint);
+static void pool_release(list_pool_t *pool);
+static list_node_t *node_alloc(list_t *list_ptr);
+static list_node_t *node_alloc_block(list_t *list_ptr, int count);
+static list_pool_t *pool_of(list_t *list_ptr);
+static void pool_join(list_t *list_a, list_t *list_b);
+static void list_index_stale(list_t *list_ptr);
+static int list_insert_keeps_order(list_t *list_ptr, void *elem_ptr,
+        list_node_t *idx_ptr);
+static list_node_t *sorted_prefix_before(list_t *list_ptr, list_node_t *pos);
+static void list_sort_suffix(list_t *list_ptr);
+static list_node_t *finger_seek(list_t *list_ptr, void *elem_ptr, int strict,
+        list_node_t *finger);
+static int node_precedes(list_t *list_ptr, list_node_t *node, void *elem_ptr,
+        int strict);
+static int list_splice_keeps_order(list_t *dst, list_node_t *pos,
+        list_node_t *first, list_node_t *last);
+static void set_check(list_t *list_a, list_t *list_b);
+static list_t *set_removed_list(list_t *list_ptr);
+static void set_drop(list_t *list_ptr, list_t *removed, list_node_t *node);
+static void set_done(list_t *list_ptr, list_t *removed);
+static list_node_t *chain_detach(list_t *list_ptr);
+static void merge_heap_sift(comparer comp_proc, list_node_t **heads, int *heap,
+        int size, int at);
+static void chain_move(list_t *dst, list_node_t *pos, list_t *src,
+        list_node_t *first, list_node_t *last, int count);
+static void node_free(list_t *list_ptr, list_node_t *node);
+static list_t *list_init_header(list_pool_t *pool);
+static void list_free_header(list_t *list_ptr);
+static list_node_t *elem_node_alloc(list_t *list_ptr, void *elem_ptr);
+static void elem_node_free(list_t *list_ptr, list_node_t *node);
+static void array_writeback(list_t *list_ptr, void **elems);
+static int node_address_order(const void *a, const void *b);
+static radix_entry_t *radix_sort_ints(radix_entry_t *entries,
+        radix_entry_t *scratch, int count, int bytes);
+static void radix_sort_strings(radix_entry_t *entries, radix_entry_t *scratch,
+        int count);
+static void radix_insertion_sort(radix_entry_t *entries, int count,
+        size_t depth);
+static int select_before(comparer comp_proc, select_entry_t *a,
+        select_entry_t *b);
+static void select_sift(comparer comp_proc, select_entry_t *heap, int size,
+        int at);
+static void select_heap_sort(comparer comp_proc, select_entry_t *entries,
+        int count);
+static int select_partition(comparer comp_proc, select_entry_t *entries,
+        int lo, int hi);
+static void list_mark_sorted(list_t *list_ptr);
+static int skip_usable(list_t *list_ptr);
+static list_node_t *skip_seek(list_t *list_ptr, void *elem_ptr, int strict,
+        skip_entry_t **update);
+static void skip_add(list_t *list_ptr, list_node_t *node, skip_entry_t **update);
+static void skip_drop(list_t *list_ptr, list_node_t *node);
+static void skip_rebuild(list_t *list_ptr);
+static void skip_clear(list_skip_t *skip);
+static int skip_random_levels(list_skip_t *skip);
+static void hash_build(list_t *list_ptr);
+static void hash_add(list_t *list_ptr, list_node_t *node);
+static void hash_drop(list_t *list_ptr, list_node_t *node);
+static list_node_t *hash_find(list_t *list_ptr, void *elem_ptr);
+static size_t hash_group(list_t *list_ptr, void *elem_ptr, unsigned long key);
+static size_t hash_slot(list_hash_t *hash, unsigned long key);
+static void hash_put(list_t *list_ptr, list_node_t *node, unsigned long key);
+static void hash_delete(list_hash_t *hash, size_t i);
+static void hash_resize(list_hash_t *hash, size_t slots);
+static list_node_t *hash_next(list_hash_t *hash, list_node_t *node);
+static list_node_t *hash_prev(list_hash_t *hash, list_node_t *node);
+static void hash_link(list_hash_t *hash, list_node_t *node, list_node_t *after);
+static void hash_unlink(list_hash_t *hash, list_node_t *node);
+static size_t hash_member_slot(list_hash_t *hash, list_node_t *node);
+static hash_member_t *hash_member(list_hash_t *hash, list_node_t *node);
+static void hash_member_set(list_hash_t *hash, list_node_t *node,
+        list_node_t *prev, list_node_t *next);
+static void hash_member_delete(list_hash_t *hash, list_node_t *node);
+static void hash_member_resize(list_hash_t *hash, size_t slots);
+static list_keys_t *keys_ready(list_t *list_ptr);
+static void keys_add(list_t *list_ptr, list_node_t *node);
+static void keys_drop(list_t *list_ptr, list_node_t *node);
+static void keys_put(list_keys_t *keys, int i, list_node_t *node);
+static long long keys_map(list_keys_t *keys, list_key_t key);
+static void keys_resize(list_keys_t *keys, int slots);
+static int keys_scan(list_keys_t *keys, long long lo, long long hi, int *count);
+static int keys_scan32(const int32_t *column, int from, int n, int32_t lo,
+        int32_t hi, int *count);
+static int keys_scan64(const int64_t *column, int from, int n, int64_t lo,
+        int64_t hi, int *count);
+#ifdef KEYS_X86
+static int keys_scan32_avx2(const int32_t *column, int n, int32_t lo,
+        int32_t hi, int *count);
+static int keys_scan32_sse2(const int32_t *column, int n, int32_t lo,
+        int32_t hi, int *count);
+static int keys_scan64_avx2(const int64_t *column, int n, int64_t lo,
+        int64_t hi, int *count);
+static int keys_scan64_sse42(const int64_t *column, int n, int64_t lo,
+        int64_t hi, int *count);
+#endif
+static list_rank_t *rank_ready(list_t *list_ptr);
+static void rank_free(list_t *list_ptr);
+static void rank_build(list_t *list_ptr);
+static int rank_idle(list_t *list_ptr);
+static void rank_add(list_t *list_ptr, list_node_t *node);
+static void rank_drop(list_t *list_ptr, list_node_t *node);
+static rank_node_t *rank_node_alloc(list_rank_t *rank, list_node_t *node);
+static int rank_count(rank_node_t *tree);
+static void rank_rotate_up(list_rank_t *rank, rank_node_t *tree);
+static size_t rank_slot(list_rank_t *rank, list_node_t *node);
+static rank_node_t *rank_lookup(list_rank_t *rank, list_node_t *node);
+static void rank_hash_put(list_rank_t *rank, rank_node_t *tree);
+static void rank_hash_delete(list_rank_t *rank, list_node_t *node);
+static void rank_hash_resize(list_rank_t *rank, size_t slots);
+static int pq_precedes(list_pq_t *pq, list_pq_node_t *a, list_pq_node_t *b);
+static list_pq_node_t *pq_meld(list_pq_t *pq, list_pq_node_t *a,
+        list_pq_node_t *b);
+static list_pq_node_t *pq_merge_pairs(list_pq_t *pq, list_pq_node_t *first);
+static void pq_free_tree(list_pq_node_t *node);
+static hazard_rec_t *hazard_acquire(void);
+static void hazard_release(void *rec);
+static void hazard_key_create(void);
+static void *hazard_protect(void **hazard, void **src);
+static void hazard_retire(hazard_rec_t *rec, queue_node_t *node);
+static void hazard_scan(hazard_rec_t *rec);
+static int view_write(FILE *file, const void *buf, size_t size);
+static int view_save(list_t *list_ptr, FILE *file, serializer ser_proc);
+static int view_header_valid(view_header_t *header, size_t length);
+static view_rec_t *view_rec_at(list_view_t *view, uint64_t offset);
+
+/* Node pool
+ *
+ * Nodes are not malloc'ed one at a time.  Each list draws its nodes from a
+ * pool that carves them out of contiguous slabs and keeps removed nodes on a
+ * free list (threaded through the next field) for reuse.  A pool may be
+ * shared by several lists (see list_construct_shared); its slabs are all
+ * released at once when the last list using it is destructed.
+ *
+ * When nodes move between lists with different pools (list_splice and
+ * friends) the two pools are merged, since the nodes of either pool may now
+ * end up in both lists.  The slabs and free nodes of one pool move into the
+ * other, and the emptied pool forwards to the merged one until every list
+ * that still refers to it has followed the forward (see pool_of).
+ *
+ * A shared pool is not thread safe, lists that share a pool must be used
+ * from one thread at a time.
+ */
 
 /* Allocates a new, empty list 
  *
@@ -34,18 +566,90 @@ Iterator find_max(list_t *, Iterator, Iterator);
  * 3.  current_list_size = 0
  * 4.  list_sorted_state = SORTED_LIST
  *
+ * The list gets a node pool of its own.  Use list_construct_capacity if the
+ * number of elements is known in advance, or list_construct_shared to draw
+ * nodes from the pool of another list.
+ *
  * Use list_decontruct to remove and deallocate all elements on a list,
  * the dummy head and tail, and the header block.
  */
 list_t * list_construct(void)
+{
+    return list_construct_capacity(0);
+}
+
+/* Allocates a new, empty list whose node pool starts with room for
+ * capacity_hint elements in a single slab.  The hint is only a hint: the
+ * list grows past it as usual.
+ */
+list_t * list_construct_capacity(int capacity_hint)
+{
+    assert(capacity_hint >= 0);
+    return list_init_header(pool_create(capacity_hint));
+}
+
+/* Allocates a new, empty list that shares the node pool of share_with.
+ *
+ * Nodes freed by either list are reused by both, and the pool lives until
+ * the last list sharing it has been destructed.  If share_with is intrusive
+ * so is the new list, with the same link offset.
+ */
+list_t * list_construct_shared(list_t *share_with)
+{
+    list_t *L;
+
+    assert(share_with != NULL);
+    pool_of(share_with)->ref_count++;
+    L = list_init_header(share_with->node_pool);
+    L->link_offset = share_with->link_offset;
+    return L;
+}
+
+/* Allocates a new, empty intrusive list.
+ *
+ * The elements of an intrusive list are records that embed a list_link_t at
+ * byte offset link_offset (use list_construct_intrusive_of to compute it).
+ * Inserting a record links it through that member, so no node is allocated,
+ * and removing it only unlinks it.  The records stay owned by the caller:
+ * list_destruct does not free them.  A record can be on only one list per
+ * embedded link at a time.
+ *
+ * Otherwise an intrusive list is a List like any other, and is sorted,
+ * searched and validated by the same code.
+ */
+list_t * list_construct_intrusive(size_t link_offset)
+{
+    list_t *L;
+
+    L = list_init_header(pool_create(0));
+    L->link_offset = (int) link_offset;
+    return L;
+}
+
+/* Allocates the header block and the dummy head and tail of a new list that
+ * draws its nodes from pool.  The caller already holds the reference to the
+ * pool that the new list takes over.
+ */
+static list_t *list_init_header(list_pool_t *pool)
 {
     list_t *L;
 
     L = (list_t *) malloc(sizeof(list_t));
+    assert(L != NULL);
+    L->node_pool = pool;
+    L->skip_index = NULL;
+    L->rank_index = NULL;
+    L->hash_index = NULL;
+    L->key_column = NULL;
+    L->link_offset = -1;
+#ifdef LIST_STATS
+    memset(&L->stats, 0, sizeof(list_stats_t));
+    L->stats_ops = 0;
+#endif
 
-    //Malloc Head and Tail nodes
-    L->head = (list_node_t *) malloc(sizeof(list_node_t));
-    L->tail = (list_node_t *) malloc(sizeof(list_node_t));
+    //Allocate Head and Tail nodes
+    L->head = node_alloc(L);
+    L->tail = node_alloc(L);
 
     //Link The head and Tail
     L->head->next = L->tail;
@@ -62,6 +666,8 @@ list_t * list_construct(void)
     
     //Set List sorted State
     L->list_sorted_state = SORTED_LIST;
+    L->sorted_tail = L->head;
+    L->finger = NULL;
     
     //Set comparison function = NULL need to call set_comp
     L->comp_proc = NULL;
@@ -71,6 +677,250 @@ list_t * list_construct(void)
     return L;
 }
 
+/* Releases the dummy head and tail and the header block of a list whose
+ * elements have already been moved elsewhere or freed.
+ */
+static void list_free_header(list_t *list_ptr)
+{
+    list_use_skip_index(list_ptr, 0);
+    rank_free(list_ptr);
+    set_hash(list_ptr, NULL);
+    set_key_column(list_ptr, NULL, LIST_KEY_INT32);
+    node_free(list_ptr, list_ptr->head);
+    node_free(list_ptr, list_ptr->tail);
+    pool_release(list_ptr->node_pool);
+    free(list_ptr);
+}
+
+/* Creates a pool whose first slab holds capacity_hint elements plus the dummy
+ * head and tail of the list.  The caller owns the only reference.
+ */
+static list_pool_t *pool_create(int capacity_hint)
+{
+    list_pool_t *pool;
+
+    pool = (list_pool_t *) malloc(sizeof(list_pool_t));
+    assert(pool != NULL);
+    pool->slabs = NULL;
+    pool->free_nodes = NULL;
+    pool->ref_count = 1;
+    pool->merged_into = NULL;
+
+    if(capacity_hint > INT_MAX - 2)
+    {
+        pool->next_slab_size = INT_MAX;
+    }
+    else if(capacity_hint > 0)
+    {
+        pool->next_slab_size = capacity_hint + 2;
+    }
+    else
+    {
+        pool->next_slab_size = POOL_MIN_SLAB;
+    }
+    return pool;
+}
+
+/* Drops one reference to the pool.  When the last list using it lets go,
+ * every slab is freed at once without visiting the nodes.
+ */
+static void pool_release(list_pool_t *pool)
+{
+    list_slab_t *slab, *next;
+
+    assert(pool->ref_count > 0);
+    if(--pool->ref_count > 0)
+    {
+        return;
+    }
+
+    //An emptied pool only holds a reference to the one it was merged into
+    if(pool->merged_into != NULL)
+    {
+        pool_release(pool->merged_into);
+        free(pool);
+        return;
+    }
+
+    slab = pool->slabs;
+    while(slab != NULL)
+    {
+        next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(pool);
+}
+
+/* Returns an unlinked node from the pool of the list, reusing a freed node if
+ * there is one and carving a new one out of the newest slab otherwise.
+ */
+static list_node_t *node_alloc(list_t *list_ptr)
+{
+    list_pool_t *pool = pool_of(list_ptr);
+    list_slab_t *slab = pool->slabs;
+    list_node_t *node;
+
+    STATS_ADD(list_ptr, node_allocs, 1);
+    if(pool->free_nodes != NULL)
+    {
+        node = pool->free_nodes;
+        pool->free_nodes = node->next;
+        return node;
+    }
+
+    if(slab == NULL || slab->nodes_used == slab->node_count)
+    {
+        slab = (list_slab_t *) malloc(sizeof(list_slab_t) +
+                pool->next_slab_size * sizeof(list_node_t));
+        assert(slab != NULL);
+        slab->node_count = pool->next_slab_size;
+        slab->nodes_used = 0;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+
+        //Grow geometrically so a big list needs only a few slabs, and go
+        //back to bounded slabs after a first one sized by a large hint
+        if(pool->next_slab_size < POOL_MAX_SLAB)
+            pool->next_slab_size *= 2;
+        if(pool->next_slab_size > POOL_MAX_SLAB)
+            pool->next_slab_size = POOL_MAX_SLAB;
+    }
+    return &slab->nodes[slab->nodes_used++];
+}
+
+/* Returns the node that is to hold elem_ptr in the list: the link embedded in
+ * the element for an intrusive list, a node from the pool otherwise.
+ */
+static list_node_t *elem_node_alloc(list_t *list_ptr, void *elem_ptr)
+{
+    if(list_ptr->link_offset >= 0)
+    {
+        return (list_node_t *) ((char *) elem_ptr + list_ptr->link_offset);
+    }
+    return node_alloc(list_ptr);
+}
+
+/* Releases the node of an element that has been unlinked from the list */
+static void elem_node_free(list_t *list_ptr, list_node_t *node)
+{
+    if(list_ptr->link_offset < 0)
+    {
+        node_free(list_ptr, node);
+    }
+}
+
+/* Puts a node that is no longer linked into any list on the free list of the
+ * pool it came from.
+ */
+static void node_free(list_t *list_ptr, list_node_t *node)
+{
+    list_pool_t *pool = pool_of(list_ptr);
+
+    STATS_ADD(list_ptr, node_frees, 1);
+    node->next = pool->free_nodes;
+    pool->free_nodes = node;
+}
+
+/* Returns count unlinked nodes that are contiguous in memory, carved out of
+ * the newest slab if it has room and out of a slab of their own otherwise.
+ */
+static list_node_t *node_alloc_block(list_t *list_ptr, int count)
+{
+    list_pool_t *pool = pool_of(list_ptr);
+    list_slab_t *slab = pool->slabs;
+
+    STATS_ADD(list_ptr, node_allocs, count);
+    if(slab != NULL && slab->node_count - slab->nodes_used >= count)
+    {
+        slab->nodes_used += count;
+        return &slab->nodes[slab->nodes_used - count];
+    }
+
+    slab = (list_slab_t *) malloc(sizeof(list_slab_t) + count * sizeof(list_node_t));
+    assert(slab != NULL);
+    slab->node_count = count;
+    slab->nodes_used = count;
+
+    //Keep the newest slab in front so its free room is still used
+    if(pool->slabs != NULL)
+    {
+        slab->next = pool->slabs->next;
+        pool->slabs->next = slab;
+    }
+    else
+    {
+        slab->next = NULL;
+        pool->slabs = slab;
+    }
+    return slab->nodes;
+}
+
+/* Returns the pool the list draws its nodes from, first moving the list over
+ * from a pool that has been merged into another one.
+ */
+static list_pool_t *pool_of(list_t *list_ptr)
+{
+    list_pool_t *pool = list_ptr->node_pool;
+
+    if(pool->merged_into == NULL)
+        return pool;
+
+    while(pool->merged_into != NULL)
+    {
+        pool = pool->merged_into;
+    }
+    pool->ref_count++;
+    pool_release(list_ptr->node_pool);
+    list_ptr->node_pool = pool;
+    return pool;
+}
+
+/* Merges the pools of two lists so that nodes can move freely between them.
+ * The slabs and free nodes of the pool of list_b move into the pool of
+ * list_a, and the emptied pool forwards to it.
+ */
+static void pool_join(list_t *list_a, list_t *list_b)
+{
+    list_pool_t *pool = pool_of(list_a);
+    list_pool_t *other = pool_of(list_b);
+    list_slab_t *slab;
+    list_node_t *node;
+
+    if(pool == other)
+        return;
+
+    //Take over the slabs behind the newest one, which keeps its room in use
+    if(other->slabs != NULL)
+    {
+        for(slab = other->slabs; slab->next != NULL; slab = slab->next)
+            ;
+        if(pool->slabs != NULL)
+        {
+            slab->next = pool->slabs->next;
+            pool->slabs->next = other->slabs;
+        }
+        else
+        {
+            pool->slabs = other->slabs;
+        }
+    }
+    if(other->free_nodes != NULL)
+    {
+        for(node = other->free_nodes; node->next != NULL; node = node->next)
+            ;
+        node->next = pool->free_nodes;
+        pool->free_nodes = other->free_nodes;
+    }
+    other->slabs = NULL;
+    other->free_nodes = NULL;
+    other->merged_into = pool;
+    pool->ref_count++;
+
+    //Move list_b over straight away, the other lists follow on their own
+    pool_of(list_b);
+}
+
 /* Sets the pointer to the comparison function
  * Must be set non NULL before any list or sorting functions
  * are used
@@ -82,24 +932,119 @@ void set_comp(list_t *list_ptr, comparer comp_proc)
 		printf("List must be constructed\n");
 		return;
 	}
+    assert(comp_proc != NULL);
+
+    //Whatever order the elements were in belonged to the old function
+    if(comp_proc != list_ptr->comp_proc && list_ptr->current_list_size > 0)
+    {
+        list_ptr->list_sorted_state = UNSORTED_LIST;
+        list_ptr->sorted_tail = list_ptr->head;
+        list_index_stale(list_ptr);
+    }
     list_ptr->comp_proc = comp_proc;
-    assert(list_ptr->comp_proc != NULL);
+}
+
+/* Gives the list a hash index over its elements, using hash_proc to hash
+ * them, or removes the index if hash_proc is NULL.
+ *
+ * hash_proc must give the same hash to elements that the comparison
+ * function ranks as equal, and an element's hash must not change while it is
+ * on the list.  With the index list_elem_find takes O(1)
+ * expected time instead of walking the list, and still returns the first
+ * match in list order.  Each list_insert, list_insert_sorted and
+ * list_remove then also hashes the element, and an element inserted into the
+ * middle of the list away from its equals walks back to the nearest of
+ * them; bulk changes and sorts make the next list_elem_find rebuild the
+ * index in O(n).
+ */
+void set_hash(list_t *list_ptr, hasher hash_proc)
+{
+    list_hash_t *hash;
+
+    assert(list_ptr != NULL);
+    hash = list_ptr->hash_index;
+    if(hash != NULL)
+    {
+        free(hash->slots);
+        free(hash->hashes);
+        free(hash->sizes);
+        free(hash->members);
+        free(hash);
+        list_ptr->hash_index = NULL;
+    }
+    if(hash_proc != NULL)
+    {
+        hash = (list_hash_t *) calloc(1, sizeof(list_hash_t));
+        assert(hash != NULL);
+        hash->hash_proc = hash_proc;
+        list_ptr->hash_index = hash;
+    }
+}
+
+/* Gives the list a key column of the keys that key_proc extracts from the
+ * elements, of the integer kind given, or removes the column if key_proc is
+ * NULL.
+ *
+ * Two elements must have equal keys exactly when the comparison function
+ * ranks them as equal, and an element's key must not change while it is on
+ * the list.  With the column list_elem_find scans the keys with SSE or AVX2
+ * compares, sorted list or not, unless the list also has a hash index, and
+ * list_key_find and list_key_count answer range queries the same way.
+ * Appending at the back and removing at either end keep the column up to
+ * date; other changes make the next query rebuild it in O(n).
+ */
+void set_key_column(list_t *list_ptr, key_extractor key_proc,
+        list_key_kind_t kind)
+{
+    list_keys_t *keys;
+
+    assert(list_ptr != NULL);
+    keys = list_ptr->key_column;
+    if(keys != NULL)
+    {
+        free(keys->keys);
+        free(keys->nodes);
+        free(keys);
+        list_ptr->key_column = NULL;
+    }
+    if(key_proc != NULL)
+    {
+        assert(kind != LIST_KEY_STRING);
+        keys = (list_keys_t *) calloc(1, sizeof(list_keys_t));
+        assert(keys != NULL);
+        keys->key_proc = key_proc;
+        keys->kind = kind;
+        keys->width = kind == LIST_KEY_INT32 ? sizeof(int32_t) : sizeof(int64_t);
+        list_ptr->key_column = keys;
+    }
 }
 
 /* Deallocates the contents of the specified list, releasing associated memory
  * resources for other purposes.
  *
  * Free all elements in the list, the dummy head and tail, and the header 
- * block.
+ * block.  The slabs of the node pool are freed in one go once no other list
+ * shares the pool.  The records on an intrusive list are left alone.
  */
 void list_destruct(list_t *list_ptr)
 {
     list_node_t  *Current = NULL, *Next = NULL;
+    int shared;
     
     /* the first line must validate the list */
     //list_debug_validate(list_ptr);
 
-    Current = list_ptr->head;    
+    //The records of an intrusive list belong to the caller
+    if(list_ptr->link_offset >= 0)
+    {
+        list_free_header(list_ptr);
+        return;
+    }
+
+    //Nodes only need to go back on the free list if another list still
+    //draws from the pool, otherwise the slabs are freed wholesale
+    shared = pool_of(list_ptr)->ref_count > 1;
+    Current = list_ptr->head->next;    
         
     while(Current != list_ptr->tail)
     {
@@ -108,11 +1053,13 @@ void list_destruct(list_t *list_ptr)
         {
             free(Current->data_ptr);
         }
-        free(Current);
+        if(shared)
+        {
+            node_free(list_ptr, Current);
+        }
         Current = Next;
     }
-        free(Current);
-        free(list_ptr);
+    list_free_header(list_ptr);
 }
 
 /* Return an Iterator that points to the first element in the list.  If the
@@ -196,19 +1143,66 @@ void * list_access(list_t *list_ptr, list_node_t * idx_ptr)
 list_node_t * list_elem_find(list_t *list_ptr, void *elem_ptr)
 {
     Iterator elem_node = NULL, current;    
+    STATS_BEGIN(list_ptr, LIST_OP_FIND);
     
-    current = list_iter_first(list_ptr);
-    while(current != list_iter_tail(list_ptr) && list_ptr->comp_proc(elem_ptr, current->data_ptr) != 0)
+    if(list_ptr->hash_index != NULL)
+    {
+        current = hash_find(list_ptr, elem_ptr);
+    }
+    else if(list_ptr->key_column != NULL)
+    {
+        //The scan of the keys beats walking nodes even in a sorted list
+        list_key_t key = list_ptr->key_column->key_proc(elem_ptr);
+
+        current = list_key_find(list_ptr, key, key);
+        if(current == NULL)
+        {
+            current = list_iter_tail(list_ptr);
+        }
+    }
+    else if(skip_usable(list_ptr))
+    {
+        //Equal elements are adjacent in a sorted list, so start from the
+        //last indexed node that precedes them and stop at the first node
+        //that does not
+        current = skip_seek(list_ptr, elem_ptr, 1, NULL);
+        while(current != list_iter_tail(list_ptr) && COMPARE(list_ptr->comp_proc, elem_ptr, current->data_ptr) == -1)
+        {
+            current = list_iter_next(current);
+            STATS_ADD(list_ptr, nodes_traversed, 1);
+        }
+        if(current != list_iter_tail(list_ptr) && COMPARE(list_ptr->comp_proc, elem_ptr, current->data_ptr) != 0)
+        {
+            current = list_iter_tail(list_ptr);
+        }
+    }
+    else if(list_ptr->finger != NULL && list_ptr->list_sorted_state == SORTED_LIST)
+    {
+        //The same, searching from the last position used
+        current = finger_seek(list_ptr, elem_ptr, 1, list_ptr->finger);
+        if(current != list_iter_tail(list_ptr) && COMPARE(list_ptr->comp_proc, elem_ptr, current->data_ptr) != 0)
+        {
+            current = list_iter_tail(list_ptr);
+        }
+    }
+    else
     {
-        current = list_iter_next(current);
+        current = list_iter_first(list_ptr);
+        while(current != list_iter_tail(list_ptr) && COMPARE(list_ptr->comp_proc, elem_ptr, current->data_ptr) != 0)
+        {
+            current = list_iter_next(current);
+            STATS_ADD(list_ptr, nodes_traversed, 1);
+        }
     }
     
     if(current != list_iter_tail(list_ptr))
     {
         elem_node = current;
+        list_ptr->finger = current;
     }    
     
     //list_debug_validate(list_ptr);
+    STATS_END(list_ptr, LIST_OP_FIND);
 
     /* fix the return value */
     return elem_node;
@@ -238,19 +1232,46 @@ list_node_t * list_elem_find(list_t *list_ptr, void *elem_ptr)
  * to insert at the front of the list do
  *      list_insert(mylist, myelem, list_iter_front(mylist))
  *
- * Note that use of this function results in the list to be marked as unsorted,
- * even if the element has been inserted in the correct position.  That is, on
- * completion of this subroutine the list_ptr->list_sorted_state must be equal 
- * to UNSORTED_LIST.
+ * A sorted list stays sorted if the element lands in order between its new
+ * neighbours, which costs up to two comparisons, so building a list by
+ * appending elements that are already in order never makes it unsorted.
+ * Otherwise the list is marked as unsorted, and remembers where its sorted
+ * prefix ends: the prefix grows while elements are appended in order right
+ * behind it, is untouched by appends behind an unsorted suffix, and is
+ * forgotten when an unsorted list is inserted into anywhere else.  list_sort
+ * only sorts the elements after the prefix and merges them in.
  */
 void list_insert(list_t *list_ptr, void *elem_ptr, list_node_t * idx_ptr)
 {
     list_node_t * new_node;
+    list_node_t *sorted_tail;
+    int in_order;
 
     assert(list_ptr != NULL);
+    STATS_BEGIN(list_ptr, LIST_OP_INSERT);
+
+    //Work out what happens to the sorted prefix before linking the node
+    sorted_tail = list_ptr->sorted_tail;
+    if(list_ptr->list_sorted_state == SORTED_LIST)
+    {
+        in_order = list_insert_keeps_order(list_ptr, elem_ptr, idx_ptr);
+        sorted_tail = idx_ptr->prev;
+    }
+    else if(idx_ptr->prev == sorted_tail)
+    {
+        //Right behind the prefix only the left neighbour matters
+        in_order = list_ptr->comp_proc != NULL && (sorted_tail == list_ptr->head ||
+            COMPARE(list_ptr->comp_proc, sorted_tail->data_ptr, elem_ptr) != -1);
+    }
+    else
+    {
+        in_order = 0;
+        if(idx_ptr != list_ptr->tail)
+            sorted_tail = list_ptr->head;
+    }
 
-    //Malloc node memory
-    new_node = (list_node_t *) malloc(sizeof(list_node_t));
+    //Get node memory from the pool, or use the link in the element
+    new_node = elem_node_alloc(list_ptr, elem_ptr);
 
     //Link node to data element
     new_node->data_ptr = elem_ptr;
@@ -263,13 +1284,58 @@ void list_insert(list_t *list_ptr, void *elem_ptr, list_node_t * idx_ptr)
     
     //Increment the List size
     list_ptr->current_list_size++;
+    if(list_ptr->rank_index != NULL)
+        rank_add(list_ptr, new_node);
+    if(list_ptr->hash_index != NULL)
+        hash_add(list_ptr, new_node);
+    if(list_ptr->key_column != NULL)
+        keys_add(list_ptr, new_node);
 
-    /* the last two lines of this function must be the following */
-    if (list_ptr->list_sorted_state == SORTED_LIST) 
-	list_ptr->list_sorted_state = UNSORTED_LIST;
+    if(list_ptr->list_sorted_state == SORTED_LIST)
+    {
+        if(!in_order)
+        {
+            //The skip list index goes stale until the list is sorted again
+            STATS_ADD(list_ptr, unsorted_transitions, 1);
+            list_ptr->list_sorted_state = UNSORTED_LIST;
+            list_ptr->sorted_tail = sorted_tail;
+            if(list_ptr->skip_index != NULL)
+                list_ptr->skip_index->valid = 0;
+        }
+    }
+    else if(in_order)
+    {
+        //The prefix grows, and may now cover the whole list
+        list_ptr->sorted_tail = new_node;
+        if(new_node->next == list_ptr->tail)
+            list_ptr->list_sorted_state = SORTED_LIST;
+    }
+    else
+    {
+        list_ptr->sorted_tail = sorted_tail;
+    }
+    STATS_END(list_ptr, LIST_OP_INSERT);
     //list_debug_validate(list_ptr);
 }
 
+/* Returns 1 if elem_ptr, inserted in front of idx_ptr, would be in order
+ * with its neighbours.  Lists without a comparison function have no order
+ * to keep.
+ */
+static int list_insert_keeps_order(list_t *list_ptr, void *elem_ptr,
+        list_node_t *idx_ptr)
+{
+    if(list_ptr->comp_proc == NULL)
+        return 0;
+    if(idx_ptr->prev != list_ptr->head &&
+            COMPARE(list_ptr->comp_proc, idx_ptr->prev->data_ptr, elem_ptr) == -1)
+        return 0;
+    if(idx_ptr != list_ptr->tail &&
+            COMPARE(list_ptr->comp_proc, elem_ptr, idx_ptr->data_ptr) == -1)
+        return 0;
+    return 1;
+}
+
 /* Inserts the element into the specified sorted list at the proper position,
  * as defined by the compare_proc.
  *
@@ -279,11 +1345,12 @@ void list_insert(list_t *list_ptr, void *elem_ptr, list_node_t * idx_ptr)
  *
  * If you use list_insert_sorted, the list preserves its sorted nature.
  *
- * If you use list_insert, the list will be considered to be unsorted, even
- * if the element has been inserted in the correct position.
+ * If you use list_insert, the list stays sorted only if the element lands in
+ * order between its neighbours, and is marked unsorted otherwise (see
+ * list_insert).
  *
- * If the list is not sorted and you call list_insert_sorted, this subroutine
- * must generate a system error and the program should immediately stop.
+ * The list must be sorted: calling list_insert_sorted on an unsorted list is
+ * an assertion failure, so list_sort it first.
  *
  * The comparison procedure must accept two arguments (A and B) which are both
  * pointers to elements of type data_t.  The comparison procedure returns an
@@ -296,27 +1363,59 @@ void list_insert(list_t *list_ptr, void *elem_ptr, list_node_t * idx_ptr)
  * Note: if the element to be inserted is equal in rank to an element already
  * in the list, the newly inserted element will be placed after all the
  * elements of equal rank that are already in the list.
+ *
+ * Without a skip list index the search starts from the finger, the node
+ * last inserted or found, and walks from there towards the new element, so
+ * streams of elements that land close to each other cost O(distance) each.
  */
 void list_insert_sorted(list_t *list_ptr, void *elem_ptr)
 {
-    Iterator node;
+    list_insert_sorted_hint(list_ptr, elem_ptr, NULL);
+}
+
+/* Inserts the element into the sorted list like list_insert_sorted, but
+ * searches for its position from hint, a node of the list the caller knows
+ * to be near it.  A NULL hint, or the dummy head or tail, uses the finger.
+ *
+ * The search walks from hint in the direction of the element even if the
+ * list has a skip list index, and the new node is then left without an
+ * entry in the index.
+ */
+void list_insert_sorted_hint(list_t *list_ptr, void *elem_ptr, list_node_t *hint)
+{
+    Iterator node;
     list_node_t *new;  
+    skip_entry_t *update[SKIP_MAX_LEVEL];
+    int indexed = 0;
     
     assert(list_ptr != NULL);
     assert(list_ptr->list_sorted_state == SORTED_LIST);
     assert(list_ptr->comp_proc != NULL);
+    STATS_BEGIN(list_ptr, LIST_OP_INSERT_SORTED);
 
-    /* insert your code here */
-    
-    //Set node to first list node
-    node = list_iter_first(list_ptr);
-    while(node != list_iter_tail(list_ptr) && list_ptr->comp_proc(elem_ptr, node->data_ptr) != 1)
+    if(hint == list_ptr->tail)
+        hint = hint->prev;
+    if(hint == list_ptr->head)
+        hint = NULL;
+
+    //Set node to the first node greater than the new element, or to the
+    //first list node or the last indexed node that is not greater than it
+    if(hint != NULL)
+        node = finger_seek(list_ptr, elem_ptr, 0, hint);
+    else if((indexed = skip_usable(list_ptr)))
+        node = skip_seek(list_ptr, elem_ptr, 0, update);
+    else if(list_ptr->finger != NULL)
+        node = finger_seek(list_ptr, elem_ptr, 0, list_ptr->finger);
+    else
+        node = list_iter_first(list_ptr);
+    while(node != list_iter_tail(list_ptr) && COMPARE(list_ptr->comp_proc, elem_ptr, node->data_ptr) != 1)
     {
         node = list_iter_next(node);
+        STATS_ADD(list_ptr, nodes_traversed, 1);
     }
     
-    //malloc a new list node to put in list
-    new = (list_node_t *) malloc(sizeof(list_node_t));
+    //get a new list node from the pool to put in list
+    new = elem_node_alloc(list_ptr, elem_ptr);
     
     //Link the new node into the list
     new->next = node;
@@ -330,11 +1429,70 @@ void list_insert_sorted(list_t *list_ptr, void *elem_ptr)
     //Increment List size
     list_ptr->current_list_size++;  
 
+    if(indexed)
+        skip_add(list_ptr, new, update);
+    if(list_ptr->rank_index != NULL)
+        rank_add(list_ptr, new);
+    if(list_ptr->hash_index != NULL)
+        hash_add(list_ptr, new);
+    if(list_ptr->key_column != NULL)
+        keys_add(list_ptr, new);
+    list_ptr->finger = new;
+    STATS_END(list_ptr, LIST_OP_INSERT_SORTED);
    
     /* the last line of this function must be the following */
     //list_debug_validate(list_ptr);
 }
 
+/* Returns the first node of the sorted list that elem_ptr does not follow,
+ * like skip_seek followed by its walk: the first node greater than elem_ptr,
+ * or with strict set the first node not less than it.  The walk starts at
+ * finger and goes backwards or forwards as the element is found to lie.
+ * Positions before the first node or after the last one are recognized
+ * after a single comparison.
+ */
+static list_node_t *finger_seek(list_t *list_ptr, void *elem_ptr, int strict,
+        list_node_t *finger)
+{
+    list_node_t *node;
+
+    if(node_precedes(list_ptr, finger, elem_ptr, strict))
+    {
+        //Forwards, unless the element goes after the last node anyway
+        node = list_ptr->tail->prev;
+        if(node != finger && node_precedes(list_ptr, node, elem_ptr, strict))
+            return list_ptr->tail;
+        for(node = finger->next; node != list_ptr->tail &&
+                node_precedes(list_ptr, node, elem_ptr, strict); node = node->next)
+        {
+            STATS_ADD(list_ptr, nodes_traversed, 1);
+        }
+        return node;
+    }
+
+    //Backwards, unless the element goes before the first node anyway
+    node = list_ptr->head->next;
+    if(node == finger || !node_precedes(list_ptr, node, elem_ptr, strict))
+        return node;
+    for(node = finger; !node_precedes(list_ptr, node->prev, elem_ptr, strict);
+            node = node->prev)
+    {
+        STATS_ADD(list_ptr, nodes_traversed, 1);
+    }
+    return node;
+}
+
+/* Returns 1 if node goes before elem_ptr in the order of the list: if it is
+ * less than elem_ptr when strict is set, or not greater than it otherwise.
+ */
+static int node_precedes(list_t *list_ptr, list_node_t *node, void *elem_ptr,
+        int strict)
+{
+    int rank = COMPARE(list_ptr->comp_proc, elem_ptr, node->data_ptr);
+
+    return strict ? rank == -1 : rank != 1;
+}
+
 /* Removes the element from the specified list that is found at the list_node_t  index.  A pointer to the data element is returned.
  *
  * list_ptr: pointer to list-of-interest.  
@@ -359,253 +1517,4507 @@ void * list_remove(list_t *list_ptr, list_node_t * idx_ptr)
     assert(idx_ptr != list_ptr->head && idx_ptr != list_ptr->tail);
     assert(idx_ptr->data_ptr != NULL);
     assert(list_ptr->current_list_size > 0);
+    STATS_BEGIN(list_ptr, LIST_OP_REMOVE);
 
     data = idx_ptr->data_ptr;
     
+    if(list_ptr->skip_index != NULL && list_ptr->skip_index->valid &&
+            list_ptr->list_sorted_state == SORTED_LIST)
+        skip_drop(list_ptr, idx_ptr);
+    if(idx_ptr == list_ptr->sorted_tail)
+        list_ptr->sorted_tail = idx_ptr->prev;
+    if(idx_ptr == list_ptr->finger)
+        list_ptr->finger = idx_ptr->prev != list_ptr->head ? idx_ptr->prev : NULL;
+    if(list_ptr->rank_index != NULL)
+        rank_drop(list_ptr, idx_ptr);
+    if(list_ptr->hash_index != NULL)
+        hash_drop(list_ptr, idx_ptr);
+    if(list_ptr->key_column != NULL)
+        keys_drop(list_ptr, idx_ptr);
+
     //Remove node from the list and recconect the links
     idx_ptr->next->prev = idx_ptr->prev;
     idx_ptr->prev->next = idx_ptr->next;
 
-    //Free node memory
-    free(idx_ptr);
+    //Return node memory to the pool
+    elem_node_free(list_ptr, idx_ptr);
 
     //Decrement the List size
     list_ptr->current_list_size--;
 
+    //Removing the last unsorted element leaves the list in order
+    if(list_ptr->list_sorted_state == UNSORTED_LIST &&
+            list_ptr->sorted_tail->next == list_ptr->tail)
+        list_ptr->list_sorted_state = SORTED_LIST;
+    STATS_END(list_ptr, LIST_OP_REMOVE);
+
     /* the last line should verify the list is valid after the remove */
     //list_debug_validate(list_ptr);
 
     return data;
 }
 
-void list_sort(list_t *list_ptr)
+/* Moves the elements in the range [first, last) of src into dst, in front of
+ * the position pos.  No element is copied and no node allocated; the range is
+ * unlinked from src and linked into dst as a whole.
+ *
+ * last may be list_iter_tail(src) to move everything from first on.  src and
+ * dst may be the same list as long as pos is not inside the range.  Both
+ * lists must be of the same kind: plain, or intrusive with the same link.
+ *
+ * The sizes of both lists are kept up to date, which takes a walk over the
+ * range unless the range is all of src.  dst stays sorted if it was sorted,
+ * the range came from a sorted list, and the range fits between the
+ * neighbours of pos in the order of dst.  Otherwise dst becomes unsorted.
+ */
+void list_splice(list_t *dst, list_node_t *pos, list_t *src,
+        list_node_t *first, list_node_t *last)
 {
-    
-    merge_sort(list_ptr);
-    
-    /* No longer supports selection of sorting algorithm instead defaults to merge sort
-    if(sort_type == 1)
+    list_node_t *node, *sorted_tail;
+    int count = 0, sorted;
+
+    assert(dst != NULL && src != NULL && pos != NULL);
+    assert(first != NULL && last != NULL);
+    assert(dst->link_offset == src->link_offset);
+    assert(first != src->head && pos != dst->head);
+
+    //Moving a range in front of itself changes nothing
+    if(first == last || (src == dst && (pos == first || pos == last)))
+        return;
+    STATS_BEGIN(dst, LIST_OPS);
+
+    //The size of a range that is not the whole list has to be counted
+    if(src == dst)
+        count = 0;
+    else if(first == src->head->next && last == src->tail)
+        count = src->current_list_size;
+    else
+        for(node = first; node != last; node = node->next)
+            count++;
+
+    sorted = dst->list_sorted_state == SORTED_LIST &&
+        (src == dst || src->list_sorted_state == SORTED_LIST) &&
+        list_splice_keeps_order(dst, pos, first, last->prev);
+    sorted_tail = src == dst ? dst->head : sorted_prefix_before(dst, pos);
+
+    chain_move(dst, pos, src, first, last->prev, count);
+    STATS_END(dst, LIST_OPS);
+
+    //The indexes of dst do not hold the moved nodes, even when dst stays
+    //sorted
+    list_index_stale(dst);
+    if(!sorted)
     {
-        insert_sort(list_ptr);
+        dst->list_sorted_state = UNSORTED_LIST;
+        dst->sorted_tail = sorted_tail;
     }
-    else if(sort_type == 2)
+}
+
+/* Moves all the elements of src to the end of dst in O(1), leaving src empty.
+ * The order rules of list_splice apply.
+ */
+void list_append_list(list_t *dst, list_t *src)
+{
+    assert(dst != src);
+    list_splice(dst, dst->tail, src, src->head->next, src->tail);
+}
+
+/* Inserts the count elements of the array elems in front of idx_ptr, in array
+ * order.  The nodes for all of them are allocated as one block.  Like
+ * list_insert this marks the list as unsorted.
+ */
+void list_insert_array(list_t *list_ptr, void **elems, int count,
+        list_node_t *idx_ptr)
+{
+    list_node_t *block = NULL, *node, *prev;
+    int i;
+
+    assert(list_ptr != NULL && idx_ptr != NULL && idx_ptr != list_ptr->head);
+    assert(count >= 0 && (elems != NULL || count == 0));
+    if(count == 0)
+        return;
+
+    if(list_ptr->link_offset < 0)
+        block = node_alloc_block(list_ptr, count);
+
+    list_ptr->sorted_tail = sorted_prefix_before(list_ptr, idx_ptr);
+    prev = idx_ptr->prev;
+    for(i = 0; i < count; i++)
     {
-        recursive_select_sort(list_ptr, list_ptr->head->next, list_ptr->tail);
+        assert(elems[i] != NULL);
+        if(block != NULL)
+            node = &block[i];
+        else
+            node = (list_node_t *) ((char *) elems[i] + list_ptr->link_offset);
+        node->data_ptr = elems[i];
+        node->prev = prev;
+        prev->next = node;
+        prev = node;
     }
-    else if(sort_type == 3)
+    prev->next = idx_ptr;
+    idx_ptr->prev = prev;
+
+    list_ptr->current_list_size += count;
+    list_ptr->list_sorted_state = UNSORTED_LIST;
+    list_index_stale(list_ptr);
+}
+
+/* Removes the elements in the range [first, last) from the list and returns
+ * them, in order, as a new list.  The new list shares the node pool and the
+ * comparison function of list_ptr, and is sorted if list_ptr is.
+ */
+list_t * list_remove_range(list_t *list_ptr, list_node_t *first, list_node_t *last)
+{
+    list_t *removed;
+
+    assert(list_ptr != NULL);
+    removed = list_construct_shared(list_ptr);
+    removed->comp_proc = list_ptr->comp_proc;
+    removed->list_sorted_state = list_ptr->list_sorted_state;
+    list_splice(removed, removed->tail, list_ptr, first, last);
+    return removed;
+}
+
+/* Set algebra on sorted lists
+ *
+ * The functions below take lists that are sorted by the same comparison
+ * function and walk them side by side, so each costs O(n + m) comparisons
+ * (list_merge_many O(n log k)).  Nodes are only relinked, never allocated or
+ * freed, and the lists stay sorted.  Elements that leave a list go to a new
+ * list that is returned, as with list_remove_range, for the caller to keep
+ * or list_destruct.  An element counts as present in a list if the list
+ * holds one of equal rank; duplicates within a list are left alone except by
+ * list_unique.
+ */
+
+/* Moves every element of src into dst, in order, leaving src empty.  Of
+ * elements of equal rank those of dst stay first.  The merge gallops through
+ * long stretches taken from one side.
+ */
+void list_merge_sorted(list_t *dst, list_t *src)
+{
+    list_node_t *chain_l, *chain_r, *last;
+
+    set_check(dst, src);
+    assert(dst != src);
+    //list_append_list counts its own work
+    if(dst->current_list_size == 0 || src->current_list_size == 0)
     {
-        iter_select_sort(list_ptr, list_ptr->head->next, list_ptr->tail);
+        list_append_list(dst, src);
+        return;
     }
-    else if(sort_type == 4)
+    STATS_BEGIN(dst, LIST_OPS);
+    if(dst->link_offset < 0)
+        pool_join(dst, src);
+
+    chain_l = chain_detach(dst);
+    chain_r = chain_detach(src);
+    relink_chain(dst, merge_runs(dst->comp_proc, chain_l, chain_r, &last));
+    dst->current_list_size += src->current_list_size;
+    src->current_list_size = 0;
+    list_index_stale(dst);
+    list_index_stale(src);
+    src->finger = NULL;
+    STATS_END(dst, LIST_OPS);
+}
+
+/* Moves the elements of src that are not present in dst into dst, in order.
+ * Of several equal elements of src only the first moves.  What stays behind
+ * in src are the elements dst already had.
+ */
+void list_union(list_t *dst, list_t *src)
+{
+    list_node_t *pos, *node, *next, *last_moved = NULL;
+    int moved = 0, c;
+
+    set_check(dst, src);
+    assert(dst != src);
+    STATS_BEGIN(dst, LIST_OPS);
+    if(dst->link_offset < 0)
+        pool_join(dst, src);
+
+    pos = dst->head->next;
+    for(node = src->head->next; node != src->tail; node = next)
     {
-        merge_sort(list_ptr);
+        next = node->next;
+
+        //pos becomes the first node of dst not less than node
+        c = 1;
+        while(pos != dst->tail &&
+                (c = COMPARE(dst->comp_proc, pos->data_ptr, node->data_ptr)) == 1)
+            pos = pos->next;
+        if(pos != dst->tail && c == 0)
+            continue;
+        //The node moved in just before may be equal to this one
+        if(pos->prev == last_moved &&
+                COMPARE(dst->comp_proc, last_moved->data_ptr, node->data_ptr) == 0)
+            continue;
+
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = pos->prev;
+        node->next = pos;
+        pos->prev->next = node;
+        pos->prev = node;
+        last_moved = node;
+        moved++;
     }
-    */
-    list_ptr->list_sorted_state = SORTED_LIST;
-    list_debug_validate(list_ptr);
+
+    dst->current_list_size += moved;
+    src->current_list_size -= moved;
+    if(moved > 0)
+    {
+        list_index_stale(dst);
+        list_index_stale(src);
+        src->finger = NULL;
+    }
+    STATS_END(dst, LIST_OPS);
 }
 
-void insert_sort(list_t *list_ptr)
+/* Removes the elements of list_ptr that are not present in other, and
+ * returns them as a new sorted list.  other is not changed.
+ */
+list_t * list_intersect(list_t *list_ptr, list_t *other)
 {
-    list_t *list_2;
-    
-    list_2 = list_construct();
-    set_comp(list_2, list_ptr->comp_proc);
-    
-    do
+    list_t *removed;
+    list_node_t *node, *next, *match;
+
+    set_check(list_ptr, other);
+    assert(list_ptr != other);
+    STATS_BEGIN(list_ptr, LIST_OPS);
+    removed = set_removed_list(list_ptr);
+    match = other->head->next;
+    for(node = list_ptr->head->next; node != list_ptr->tail; node = next)
     {
-        list_insert_sorted(list_2, list_remove(list_ptr, list_ptr->head->next));
+        next = node->next;
+        while(match != other->tail &&
+                COMPARE(list_ptr->comp_proc, match->data_ptr, node->data_ptr) == 1)
+            match = match->next;
+        if(match == other->tail ||
+                COMPARE(list_ptr->comp_proc, node->data_ptr, match->data_ptr) != 0)
+            set_drop(list_ptr, removed, node);
     }
-    while(list_ptr->current_list_size != 0);
-    
-    list_ptr->head->next = list_2->head->next;
-    list_2->head->next->prev = list_ptr->head;
-    list_ptr->tail->prev = list_2->tail->prev;
-    list_2->tail->prev->next = list_ptr->tail;
-    list_ptr->current_list_size = list_2->current_list_size;
-    
-    free(list_2->tail);
-    free(list_2->head);
-    free(list_2);
+    set_done(list_ptr, removed);
+    STATS_END(list_ptr, LIST_OPS);
+    return removed;
 }
 
-void recursive_select_sort(list_t *list_ptr, Iterator min, Iterator max)
+/* Removes the elements of list_ptr that are present in other, and returns
+ * them as a new sorted list.  other is not changed.
+ */
+list_t * list_difference(list_t *list_ptr, list_t *other)
 {
-    Iterator maxpos;
-    Iterator hold_min;
-    void *hold;
-    
-    if(min != max->prev)
+    list_t *removed;
+    list_node_t *node, *next, *match;
+
+    set_check(list_ptr, other);
+    assert(list_ptr != other);
+    STATS_BEGIN(list_ptr, LIST_OPS);
+    removed = set_removed_list(list_ptr);
+    match = other->head->next;
+    for(node = list_ptr->head->next; node != list_ptr->tail; node = next)
     {
-        maxpos = find_max(list_ptr, min, max->prev);
-        if(maxpos != min)
-        {
-            hold_min = min;
-            min = min->prev;
-            hold = list_remove(list_ptr, hold_min);
-            list_insert(list_ptr, hold, maxpos);
-            hold = list_remove(list_ptr, maxpos);
-            min = min->next;
-            list_insert(list_ptr, hold, min);
-        }
-        else
-        {
-            min = min->next;
-        }
-        
-        recursive_select_sort(list_ptr, min, max);
+        next = node->next;
+        while(match != other->tail &&
+                COMPARE(list_ptr->comp_proc, match->data_ptr, node->data_ptr) == 1)
+            match = match->next;
+        if(match != other->tail &&
+                COMPARE(list_ptr->comp_proc, node->data_ptr, match->data_ptr) == 0)
+            set_drop(list_ptr, removed, node);
     }
+    set_done(list_ptr, removed);
+    STATS_END(list_ptr, LIST_OPS);
+    return removed;
 }
 
-void iter_select_sort(list_t *list_ptr, Iterator min, Iterator max)
+/* Removes every element that is equal to the element before it, keeping the
+ * first of each run of equal elements, and returns the removed ones as a new
+ * sorted list.
+ */
+list_t * list_unique(list_t *list_ptr)
 {
-    Iterator maxpos;
-    Iterator hold_min;
-    void *hold;
-    
-    while(min != max->prev)
+    list_t *removed;
+    list_node_t *node, *next, *kept;
+
+    set_check(list_ptr, list_ptr);
+    STATS_BEGIN(list_ptr, LIST_OPS);
+    removed = set_removed_list(list_ptr);
+    kept = list_ptr->head->next;
+    if(kept != list_ptr->tail)
     {
-        maxpos = find_max(list_ptr, min, max->prev);
-        
-        if(maxpos != min)
-        {
-            hold_min = min;
-            min = min->prev;
-            hold = list_remove(list_ptr, hold_min);
-            list_insert(list_ptr, hold, maxpos);
-            hold = list_remove(list_ptr, maxpos);
-            min = min->next;
-            list_insert(list_ptr, hold, min);
-        }
-        else
+        for(node = kept->next; node != list_ptr->tail; node = next)
         {
-            min = min->next;
+            next = node->next;
+            if(COMPARE(list_ptr->comp_proc, kept->data_ptr, node->data_ptr) == 0)
+                set_drop(list_ptr, removed, node);
+            else
+                kept = node;
         }
-        
     }
+    set_done(list_ptr, removed);
+    STATS_END(list_ptr, LIST_OPS);
+    return removed;
 }
 
-void merge_sort(list_t *list_ptr)
+/* Moves every element of lists[1] to lists[count - 1] into lists[0], merging
+ * all count lists in one pass with a binary heap over the first remaining
+ * node of each.  Of elements of equal rank those of the earlier list come
+ * first.  The other lists are left empty.
+ */
+void list_merge_many(list_t **lists, int count)
 {
-    list_t *list_r;    
-    
-    if(list_ptr->current_list_size > 1)
+    list_t *dst;
+    list_node_t **heads, *first = NULL, **link = &first;
+    int *heap;
+    int size = 0, total = 0, i;
+
+    assert(lists != NULL && count > 0);
+    dst = lists[0];
+    STATS_BEGIN(dst, LIST_OPS);
+    heads = (list_node_t **) malloc(count * (sizeof(list_node_t *) + sizeof(int)));
+    assert(heads != NULL);
+    heap = (int *) (heads + count);
+
+    for(i = 0; i < count; i++)
     {
-        list_r = split_list(list_ptr);
-        merge_sort(list_ptr);
-        merge_sort(list_r);
-        merge(list_ptr, list_r);
+        set_check(dst, lists[i]);
+        assert(i == 0 || lists[i] != dst);
+        if(i > 0 && dst->link_offset < 0)
+            pool_join(dst, lists[i]);
+        total += lists[i]->current_list_size;
+        heads[i] = chain_detach(lists[i]);
+        if(heads[i] != NULL)
+            heap[size++] = i;
+        if(i > 0)
+        {
+            lists[i]->current_list_size = 0;
+            list_index_stale(lists[i]);
+            lists[i]->finger = NULL;
+        }
+    }
+    for(i = size / 2 - 1; i >= 0; i--)
+        merge_heap_sift(dst->comp_proc, heads, heap, size, i);
+
+    //Take the smallest head, then restore the heap below its successor
+    while(size > 1)
+    {
+        i = heap[0];
+        *link = heads[i];
+        link = &heads[i]->next;
+        heads[i] = heads[i]->next;
+        if(heads[i] == NULL)
+            heap[0] = heap[--size];
+        merge_heap_sift(dst->comp_proc, heads, heap, size, 0);
     }
+    if(size == 1)
+        *link = heads[heap[0]];
+
+    relink_chain(dst, first);
+    dst->current_list_size = total;
+    list_index_stale(dst);
+    free(heads);
+    STATS_END(dst, LIST_OPS);
 }
 
-list_t* split_list(list_t *list_ptr)
+/* Asserts that two lists can be combined by the set algebra functions */
+static void set_check(list_t *list_a, list_t *list_b)
 {
-    list_t *list_r;
-    int list_size;
-    int i;
-    Iterator current;
-    
-    list_r = list_construct();
-    set_comp(list_r, list_ptr->comp_proc);
-    
-    current = list_ptr->head->next;
-    list_size = list_ptr->current_list_size;
-    
-    for(i = 0; i < list_size/2; i++)
+    assert(list_a != NULL && list_b != NULL && list_a->comp_proc != NULL);
+    assert(list_a->comp_proc == list_b->comp_proc);
+    assert(list_a->link_offset == list_b->link_offset);
+    assert(list_a->list_sorted_state == SORTED_LIST);
+    assert(list_b->list_sorted_state == SORTED_LIST);
+}
+
+/* Returns an empty sorted list to hold the elements removed from list_ptr */
+static list_t *set_removed_list(list_t *list_ptr)
+{
+    list_t *removed = list_construct_shared(list_ptr);
+
+    removed->comp_proc = list_ptr->comp_proc;
+    return removed;
+}
+
+/* Moves node from list_ptr to the end of removed */
+static void set_drop(list_t *list_ptr, list_t *removed, list_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = removed->tail->prev;
+    node->next = removed->tail;
+    removed->tail->prev->next = node;
+    removed->tail->prev = node;
+    list_ptr->current_list_size--;
+    removed->current_list_size++;
+}
+
+/* Lets the indexes of list_ptr know about the nodes that went to removed */
+static void set_done(list_t *list_ptr, list_t *removed)
+{
+    if(removed->current_list_size > 0)
     {
-        current = current->next;
+        list_ptr->finger = NULL;
+        list_index_stale(list_ptr);
     }
-    
-    list_r->head->next = current;
-    list_r->tail->prev = list_ptr->tail->prev;
-    list_ptr->tail->prev->next = list_r->tail;
-    current->prev->next = list_ptr->tail;
-    list_ptr->tail->prev = current->prev;
-    current->prev = list_r->head;
-    
-    list_r->current_list_size = list_ptr->current_list_size - list_size/2;
-    list_ptr->current_list_size = list_size/2;
-    
-    //list_debug_validate(list_ptr);
-    //list_debug_validate(list_r);
-    
-    return list_r;
 }
 
-void merge(list_t *list_l, list_t *list_r)
+/* Unlinks all nodes of the list from its dummy head and tail and returns
+ * them as a NULL terminated chain (NULL if the list is empty).  The size is
+ * left for the caller to fix.
+ */
+static list_node_t *chain_detach(list_t *list_ptr)
 {
-    Iterator idx_l;
-    Iterator idx_r;
-    
-    idx_r = list_r->head->next;
-    idx_l = list_l->head->next;
-    
-    while(idx_r != list_r->tail && idx_l != list_l->tail)
+    list_node_t *first = list_ptr->head->next;
+
+    if(first == list_ptr->tail)
+        return NULL;
+    list_ptr->tail->prev->next = NULL;
+    list_ptr->head->next = list_ptr->tail;
+    list_ptr->tail->prev = list_ptr->head;
+    return first;
+}
+
+/* Moves entry at of the heap of list indexes down to its place.  An index
+ * goes before another if its head node ranks earlier, or equal and it is
+ * the lower index.
+ */
+static void merge_heap_sift(comparer comp_proc, list_node_t **heads, int *heap,
+        int size, int at)
+{
+    int child, c, top = heap[at];
+
+    for(; (child = 2 * at + 1) < size; at = child)
     {
-        while(idx_r != list_r->tail && idx_l != list_l->tail && list_l->comp_proc(idx_l->data_ptr, idx_r->data_ptr) != -1)
-        {
-            idx_l = idx_l->next;
-        }
-        idx_l->prev->next = idx_r;
-        idx_r->prev = idx_l->prev;
-        
-        if(idx_l == list_l->tail)
-        {
-            list_l->tail->prev = list_r->tail->prev;
-            list_r->tail->prev->next = list_l->tail;
-        }
-        else
+        if(child + 1 < size)
         {
-            while(idx_r != list_r->tail && idx_l != list_l->tail && list_l->comp_proc(idx_r->data_ptr, idx_l->data_ptr) != -1)
-            {
-             idx_r = idx_r->next;
-            }
-            idx_r->prev->next = idx_l;
-            idx_l->prev = idx_r->prev;
+            c = COMPARE(comp_proc, heads[heap[child + 1]]->data_ptr,
+                    heads[heap[child]]->data_ptr);
+            if(c == 1 || (c == 0 && heap[child + 1] < heap[child]))
+                child++;
         }
+        c = COMPARE(comp_proc, heads[heap[child]]->data_ptr, heads[top]->data_ptr);
+        if(c != 1 && (c != 0 || heap[child] > top))
+            break;
+        heap[at] = heap[child];
     }
-    
-    list_l->current_list_size = list_l->current_list_size + list_r->current_list_size;
-    
-    free(list_r->tail);
-    free(list_r->head);
-    free(list_r);
+    heap[at] = top;
 }
-        
 
-Iterator find_max(list_t *list_ptr, Iterator min, Iterator max)
+/* Returns 1 if the nodes first to last, inclusive, are in order and fit in
+ * front of pos in dst without breaking its order.
+ */
+static int list_splice_keeps_order(list_t *dst, list_node_t *pos,
+        list_node_t *first, list_node_t *last)
 {
-    Iterator i = min;
-    Iterator j = min;
-    //int k = 0;
-       
-    do{
-        /*printf("K: %d\n", k);
-        k++;*/
-        i = i->next;
-        if(list_ptr->comp_proc(i->data_ptr, j->data_ptr) == 1)
-        {
-            j = i;
-        }
-    }while(i != max);
-    
-    return j;
+    list_node_t *before = pos->prev;
+
+    if(dst->comp_proc == NULL)
+        return 0;
+
+    if(before != dst->head &&
+            COMPARE(dst->comp_proc, before->data_ptr, first->data_ptr) == -1)
+        return 0;
+    if(pos != dst->tail &&
+            COMPARE(dst->comp_proc, last->data_ptr, pos->data_ptr) == -1)
+        return 0;
+    return 1;
 }
-/* Obtains the length of the specified list, that is, the number of elements
- * that the list contains. 
- *
- * list_ptr: pointer to list-of-interest.  
- *
- * Returns an integer equal to the number of elements stored in the list.  An
- * empty list has a size of zero.
+
+/* Unlinks the nodes first to last, inclusive, from src and links them into
+ * dst in front of pos.  count is the number of nodes moved, or 0 if src and
+ * dst are the same list.
  */
-int list_size(list_t *list_ptr)
+static void chain_move(list_t *dst, list_node_t *pos, list_t *src,
+        list_node_t *first, list_node_t *last, int count)
 {
-    assert(list_ptr != NULL);
-    assert(list_ptr->current_list_size >= 0);
-    return list_ptr->current_list_size;
+    if(src != dst && dst->link_offset < 0)
+        pool_join(dst, src);
+
+    first->prev->next = last->next;
+    last->next->prev = first->prev;
+
+    first->prev = pos->prev;
+    last->next = pos;
+    pos->prev->next = first;
+    pos->prev = last;
+
+    src->current_list_size -= count;
+    dst->current_list_size += count;
+    list_index_stale(src);
+
+    //Where the sorted prefix of src now ends is not known without a walk,
+    //nor whether the finger went with the range
+    if(src->list_sorted_state == UNSORTED_LIST)
+        src->sorted_tail = src->head;
+    if(src != dst)
+        src->finger = NULL;
+}
+
+/* Returns the last node of the sorted prefix that an unsorted list will have
+ * after elements of unknown order are put in front of pos.  Only prefixes
+ * that end right before pos or at the last node are known to survive.
+ */
+static list_node_t *sorted_prefix_before(list_t *list_ptr, list_node_t *pos)
+{
+    if(list_ptr->list_sorted_state == SORTED_LIST)
+        return pos->prev;
+    if(pos == list_ptr->tail || pos->prev == list_ptr->sorted_tail)
+        return list_ptr->sorted_tail;
+    return list_ptr->head;
+}
+
+/* Called when nodes have been moved in or out of the list in bulk.  Indexes
+ * that refer to nodes are rebuilt before they are used again.
+ */
+static void list_index_stale(list_t *list_ptr)
+{
+    if(list_ptr->skip_index != NULL)
+        list_ptr->skip_index->valid = 0;
+    rank_free(list_ptr);
+    if(list_ptr->hash_index != NULL)
+        list_ptr->hash_index->valid = 0;
+    if(list_ptr->key_column != NULL)
+        list_ptr->key_column->valid = 0;
 }
 
+/* Sorts the list into the order defined by the comparison function.
+ *
+ * Short lists, and long lists whose first SORTED_PROBE elements come in long
+ * runs, are sorted by relinking the nodes with the adaptive natural_sort.
+ * Other long lists are sorted by gathering their elements into an array (see
+ * list_sort_array).  Both sorts are stable.
+ *
+ * A list that is still in order up to some node (see list_insert) only has
+ * the elements after that node sorted, which are then merged into the
+ * prefix.  The prefix is trusted to be in order, so elements must not be
+ * changed in place in ways that move them in the order.
+ */
+void list_sort(list_t *list_ptr)
+{
+    STATS_BEGIN(list_ptr, LIST_OP_SORT);
+    
+    if(list_ptr->list_sorted_state == UNSORTED_LIST &&
+            list_ptr->sorted_tail != list_ptr->head)
+    {
+        list_sort_suffix(list_ptr);
+    }
+    else if(list_ptr->current_list_size < ARRAY_SORT_MIN ||
+            list_mostly_sorted(list_ptr) || !array_sort(list_ptr))
+    {
+        natural_sort(list_ptr);
+    }
+    
+    /* No longer supports selection of sorting algorithm instead defaults to merge sort
+    if(sort_type == 1)
+    {
+        insert_sort(list_ptr);
+    }
+    else if(sort_type == 2)
+    {
+        recursive_select_sort(list_ptr, list_ptr->head->next, list_ptr->tail);
+    }
+    else if(sort_type == 3)
+    {
+        iter_select_sort(list_ptr, list_ptr->head->next, list_ptr->tail);
+    }
+    else if(sort_type == 4)
+    {
+        merge_sort(list_ptr);
+    }
+    */
+    STATS_END(list_ptr, LIST_OP_SORT);
+    list_mark_sorted(list_ptr);
+}
+
+/* Sorts the elements after the sorted prefix of the list on their own, as a
+ * temporary list, and merges the result into the prefix.  Appending k
+ * elements to a sorted list of n thus costs O(k log k) comparisons for the
+ * sort plus at most O(k log n) for the galloping merge, instead of a sort of
+ * all n + k elements.
+ */
+static void list_sort_suffix(list_t *list_ptr)
+{
+    list_t *suffix;
+    list_node_t *node, *chain_l, *chain_r, *last;
+    int count = 0;
+
+    for(node = list_ptr->sorted_tail->next; node != list_ptr->tail; node = node->next)
+        count++;
+
+    suffix = list_construct_shared(list_ptr);
+    suffix->comp_proc = list_ptr->comp_proc;
+    chain_move(suffix, suffix->tail, list_ptr, list_ptr->sorted_tail->next,
+            list_ptr->tail->prev, count);
+    suffix->list_sorted_state = UNSORTED_LIST;
+    list_sort(suffix);
+
+    //Merge the two chains, detached from their dummy nodes
+    chain_l = list_ptr->head->next;
+    list_ptr->tail->prev->next = NULL;
+    chain_r = suffix->head->next;
+    suffix->tail->prev->next = NULL;
+    relink_chain(list_ptr, merge_runs(list_ptr->comp_proc, chain_l, chain_r, &last));
+    list_ptr->current_list_size += count;
+
+    suffix->head->next = suffix->tail;
+    suffix->tail->prev = suffix->head;
+    list_free_header(suffix);
+}
+
+/* Returns 1 if the first SORTED_PROBE elements of the list form runs, in
+ * either direction, that average at least MIN_RUN elements.  Such lists are
+ * nearly in order, or in reverse order, and natural_sort handles them in
+ * close to linear time.
+ */
+static int list_mostly_sorted(list_t *list_ptr)
+{
+    list_node_t *node = list_ptr->head->next;
+    int probed = 1, runs = 1, direction = 0, rank;
+
+    while(probed < SORTED_PROBE && node->next != list_ptr->tail)
+    {
+        rank = COMPARE(list_ptr->comp_proc, node->data_ptr, node->next->data_ptr);
+        if(direction == 0)
+            direction = rank;
+        else if(rank != 0 && rank != direction)
+        {
+            //A new run starts at node->next
+            runs++;
+            direction = 0;
+        }
+        node = node->next;
+        probed++;
+    }
+    return runs * MIN_RUN <= probed;
+}
+
+/* Sorts the list by sorting its element pointers in a contiguous array.
+ *
+ * The data pointers are copied out in one pass over the nodes, sorted as an
+ * array, and written back into the same nodes in order, so the links are
+ * never touched.  Note that an Iterator keeps pointing at the same position
+ * in the list, not at the same element.  On an intrusive list the nodes
+ * belong to the elements and are relinked instead.
+ *
+ * The array sort is a stable merge sort: runs of ARRAY_SORT_RUN elements are
+ * insertion sorted in place and then merged bottom-up between the array and
+ * a scratch buffer.  If the two arrays cannot be allocated the list is
+ * sorted with merge_sort instead.
+ */
+void list_sort_array(list_t *list_ptr)
+{
+    assert(list_ptr != NULL && list_ptr->comp_proc != NULL);
+    STATS_BEGIN(list_ptr, LIST_OP_SORT);
+
+    if(!array_sort(list_ptr))
+    {
+        merge_sort(list_ptr);
+    }
+    STATS_END(list_ptr, LIST_OP_SORT);
+    list_mark_sorted(list_ptr);
+}
+
+/* Does the work of list_sort_array.  Returns 0 without changing the list if
+ * memory for the arrays is not available.
+ */
+static int array_sort(list_t *list_ptr)
+{
+    void **elems, **scratch, **swap;
+    list_node_t *node;
+    int count = list_ptr->current_list_size;
+    int i, width;
+
+    if(count < 2)
+    {
+        return 1;
+    }
+    elems = (void **) malloc(2 * (size_t) count * sizeof(void *));
+    if(elems == NULL)
+    {
+        return 0;
+    }
+    scratch = elems + count;
+
+    //Gather
+    node = list_ptr->head->next;
+    for(i = 0; i < count; i++)
+    {
+        elems[i] = node->data_ptr;
+        node = node->next;
+    }
+
+    //Sort short runs in place, then merge runs of doubling width
+    for(i = 0; i < count; i += ARRAY_SORT_RUN)
+    {
+        array_insertion_sort(list_ptr->comp_proc, elems + i,
+                count - i < ARRAY_SORT_RUN ? count - i : ARRAY_SORT_RUN);
+    }
+    for(width = ARRAY_SORT_RUN; width < count; width *= 2)
+    {
+        for(i = 0; i < count; i += 2 * width)
+        {
+            if(i + width >= count)
+                array_merge(list_ptr->comp_proc, elems, i, count, count, scratch);
+            else if(i + 2 * width > count)
+                array_merge(list_ptr->comp_proc, elems, i, i + width, count, scratch);
+            else
+                array_merge(list_ptr->comp_proc, elems, i, i + width, i + 2 * width, scratch);
+        }
+        swap = elems;
+        elems = scratch;
+        scratch = swap;
+    }
+
+    array_writeback(list_ptr, elems);
+    free(elems < scratch ? elems : scratch);
+    return 1;
+}
+
+/* Sorts the list by a key that key_proc pulls out of each element, with a
+ * radix sort instead of comparisons.
+ *
+ * The keys are gathered with their elements into an array.  Integer keys
+ * (kind LIST_KEY_INT32, LIST_KEY_INT64 or LIST_KEY_UINT64, in the matching
+ * member of list_key_t) are sorted by a least significant byte first radix
+ * sort, which skips the bytes in which all keys agree.  String keys
+ * (LIST_KEY_STRING, NUL terminated) are sorted in byte order, like strcmp,
+ * by a most significant byte first radix sort that insertion sorts buckets
+ * of fewer than RADIX_STRING_MIN strings.  Both are stable.  The elements are
+ * then written back like list_sort_array does.
+ *
+ * Keys sort in ascending order.  The comparison function of the list must
+ * give the same order, since the list is marked sorted and later sorted
+ * inserts and finds go by it.  If the arrays cannot be allocated the list is
+ * merge sorted with the comparison function instead.
+ */
+void list_sort_by_key(list_t *list_ptr, key_extractor key_proc,
+        list_key_kind_t kind)
+{
+    radix_entry_t *entries, *scratch, *sorted;
+    list_node_t *node;
+    list_key_t key;
+    void **elems;
+    int count, i;
+
+    assert(list_ptr != NULL && list_ptr->comp_proc != NULL && key_proc != NULL);
+    STATS_BEGIN(list_ptr, LIST_OP_SORT);
+    count = list_ptr->current_list_size;
+    entries = NULL;
+    if(count >= 2)
+    {
+        entries = (radix_entry_t *) malloc(2 * (size_t) count * sizeof(radix_entry_t));
+    }
+    if(entries == NULL)
+    {
+        merge_sort(list_ptr);
+        STATS_END(list_ptr, LIST_OP_SORT);
+        list_mark_sorted(list_ptr);
+        return;
+    }
+    scratch = entries + count;
+
+    node = list_ptr->head->next;
+    for(i = 0; i < count; i++)
+    {
+        key = key_proc(node->data_ptr);
+        entries[i].data_ptr = node->data_ptr;
+        switch(kind)
+        {
+        case LIST_KEY_INT32:
+            entries[i].key.u = (unsigned int) key.i32 ^ 0x80000000u;
+            break;
+        case LIST_KEY_INT64:
+            entries[i].key.u = (unsigned long long) key.i64 ^ (1ULL << 63);
+            break;
+        case LIST_KEY_UINT64:
+            entries[i].key.u = key.u64;
+            break;
+        default:
+            entries[i].key.s = (const unsigned char *) key.str;
+            break;
+        }
+        node = node->next;
+    }
+
+    if(kind == LIST_KEY_STRING)
+    {
+        radix_sort_strings(entries, scratch, count);
+        sorted = entries;
+    }
+    else
+    {
+        sorted = radix_sort_ints(entries, scratch, count,
+                kind == LIST_KEY_INT32 ? 4 : 8);
+    }
+
+    //The key array is no longer needed, so the elements are packed in place
+    elems = (void **) sorted;
+    for(i = 0; i < count; i++)
+    {
+        elems[i] = sorted[i].data_ptr;
+    }
+    array_writeback(list_ptr, elems);
+    free(entries);
+    STATS_END(list_ptr, LIST_OP_SORT);
+    list_mark_sorted(list_ptr);
+}
+
+/* Sorts entries by their unsigned integer keys, of which only the low bytes
+ * are set, one byte at a time from the least significant, moving them
+ * between the two arrays.  All the byte histograms are taken in one pass.
+ * Returns the array that holds the result.
+ */
+static radix_entry_t *radix_sort_ints(radix_entry_t *entries,
+        radix_entry_t *scratch, int count, int bytes)
+{
+    int (*counts)[256];
+    radix_entry_t *swap;
+    int byte, i, sum, next;
+    unsigned int digit;
+
+    counts = (int (*)[256]) calloc(bytes, sizeof(*counts));
+    assert(counts != NULL);
+    for(i = 0; i < count; i++)
+        for(byte = 0; byte < bytes; byte++)
+            counts[byte][(entries[i].key.u >> (8 * byte)) & 0xff]++;
+
+    for(byte = 0; byte < bytes; byte++)
+    {
+        //A byte in which all keys agree would not move anything
+        digit = (entries[0].key.u >> (8 * byte)) & 0xff;
+        if(counts[byte][digit] == count)
+            continue;
+
+        sum = 0;
+        for(i = 0; i < 256; i++)
+        {
+            next = sum + counts[byte][i];
+            counts[byte][i] = sum;
+            sum = next;
+        }
+        for(i = 0; i < count; i++)
+        {
+            digit = (entries[i].key.u >> (8 * byte)) & 0xff;
+            scratch[counts[byte][digit]++] = entries[i];
+        }
+        swap = entries;
+        entries = scratch;
+        scratch = swap;
+    }
+    free(counts);
+    return entries;
+}
+
+/* Sorts entries by their string keys in place, bucketing by the byte at the
+ * current depth through scratch.  Buckets wait on an explicit stack, since
+ * the depth can be as large as the longest common prefix.  The bucket of
+ * strings that end at the current depth is done, as all of them are equal.
+ */
+static void radix_sort_strings(radix_entry_t *entries, radix_entry_t *scratch,
+        int count)
+{
+    radix_range_t *stack, range;
+    int counts[256], starts[256];
+    int size = 0, slots = 64, i, sum;
+    unsigned char digit;
+
+    stack = (radix_range_t *) malloc(slots * sizeof(radix_range_t));
+    assert(stack != NULL);
+    stack[size].lo = 0;
+    stack[size].hi = count;
+    stack[size].depth = 0;
+    size++;
+
+    while(size > 0)
+    {
+        range = stack[--size];
+        if(range.hi - range.lo < RADIX_STRING_MIN)
+        {
+            radix_insertion_sort(entries + range.lo, range.hi - range.lo,
+                    range.depth);
+            continue;
+        }
+
+        memset(counts, 0, sizeof(counts));
+        for(i = range.lo; i < range.hi; i++)
+            counts[entries[i].key.s[range.depth]]++;
+        sum = range.lo;
+        for(i = 0; i < 256; i++)
+        {
+            starts[i] = sum;
+            sum += counts[i];
+        }
+        for(i = range.lo; i < range.hi; i++)
+        {
+            digit = entries[i].key.s[range.depth];
+            scratch[starts[digit]++] = entries[i];
+        }
+        memcpy(entries + range.lo, scratch + range.lo,
+                (range.hi - range.lo) * sizeof(radix_entry_t));
+
+        //starts[i] is now the end of bucket i
+        for(i = 1; i < 256; i++)
+        {
+            if(counts[i] < 2)
+                continue;
+            if(size == slots)
+            {
+                slots *= 2;
+                stack = (radix_range_t *) realloc(stack,
+                        slots * sizeof(radix_range_t));
+                assert(stack != NULL);
+            }
+            stack[size].lo = starts[i] - counts[i];
+            stack[size].hi = starts[i];
+            stack[size].depth = range.depth + 1;
+            size++;
+        }
+    }
+    free(stack);
+}
+
+/* Stable insertion sort of a few string entries that agree on their first
+ * depth bytes.
+ */
+static void radix_insertion_sort(radix_entry_t *entries, int count,
+        size_t depth)
+{
+    radix_entry_t entry;
+    int i, j;
+
+    for(i = 1; i < count; i++)
+    {
+        entry = entries[i];
+        for(j = i; j > 0 && strcmp((const char *) entries[j - 1].key.s + depth,
+                    (const char *) entry.key.s + depth) > 0; j--)
+            entries[j] = entries[j - 1];
+        entries[j] = entry;
+    }
+}
+
+/* Puts the current_list_size elements of the array back into the list in
+ * array order.  The data pointers are written into the nodes as they are, or
+ * for an intrusive list, where each element owns its node, the nodes are
+ * relinked in the new order.
+ */
+static void array_writeback(list_t *list_ptr, void **elems)
+{
+    list_node_t *node, *prev;
+    int i;
+
+    if(list_ptr->link_offset >= 0)
+    {
+        prev = list_ptr->head;
+        for(i = 0; i < list_ptr->current_list_size; i++)
+        {
+            node = (list_node_t *) ((char *) elems[i] + list_ptr->link_offset);
+            prev->next = node;
+            node->prev = prev;
+            prev = node;
+        }
+        prev->next = list_ptr->tail;
+        list_ptr->tail->prev = prev;
+        return;
+    }
+
+    node = list_ptr->head->next;
+    for(i = 0; i < list_ptr->current_list_size; i++)
+    {
+        node->data_ptr = elems[i];
+        node = node->next;
+    }
+}
+
+/* Relinks the nodes of the list so that following the list walks through
+ * memory in ascending address order, and moves the elements between the
+ * nodes so that they stay in the same order.
+ *
+ * Lists built by appending draw their nodes from the slabs of the pool in
+ * order, but inserts in the middle, reused free nodes and relinking sorts
+ * scatter the nodes, and a walk over the list then misses the cache on
+ * about every node.  After list_compact a walk streams through the slabs.
+ * Like list_sort it costs O(n log n) and leaves Iterators into the list
+ * pointing at other elements.  Intrusive lists, whose nodes belong to the
+ * elements, are left as they are, as is the list if no memory for the
+ * arrays is available.
+ */
+void list_compact(list_t *list_ptr)
+{
+    list_node_t **nodes, *node, *prev;
+    void **elems;
+    int count, i, sorted_at = -1;
+
+    assert(list_ptr != NULL);
+    count = list_ptr->current_list_size;
+    if(list_ptr->link_offset >= 0 || count < 2)
+        return;
+    nodes = (list_node_t **) malloc(count * (sizeof(list_node_t *) + sizeof(void *)));
+    if(nodes == NULL)
+        return;
+    elems = (void **) (nodes + count);
+
+    node = list_ptr->head->next;
+    for(i = 0; i < count; i++)
+    {
+        nodes[i] = node;
+        elems[i] = node->data_ptr;
+        if(node == list_ptr->sorted_tail)
+            sorted_at = i;
+        node = node->next;
+    }
+    qsort(nodes, count, sizeof(list_node_t *), node_address_order);
+
+    prev = list_ptr->head;
+    for(i = 0; i < count; i++)
+    {
+        nodes[i]->data_ptr = elems[i];
+        nodes[i]->prev = prev;
+        prev->next = nodes[i];
+        prev = nodes[i];
+    }
+    prev->next = list_ptr->tail;
+    list_ptr->tail->prev = prev;
+
+    //The prefix ends at the same position, now in another node
+    if(sorted_at >= 0)
+        list_ptr->sorted_tail = nodes[sorted_at];
+    list_index_stale(list_ptr);
+    free(nodes);
+}
+
+/* qsort comparison of two node pointers by address */
+static int node_address_order(const void *a, const void *b)
+{
+    size_t x = (size_t) *(list_node_t * const *) a;
+    size_t y = (size_t) *(list_node_t * const *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Moves the k elements that a stable sort would put first to the front of
+ * the list, in that order, leaving the others behind them in the order they
+ * were in.
+ *
+ * One pass keeps the k elements seen so far that go first in a bounded heap
+ * whose top is the one that goes last, so an element that does not belong
+ * costs one comparison and one that does O(log k); O(n log k) in all.  The
+ * list is then unsorted with a sorted prefix of k elements (see list_insert),
+ * all in front of the rest in the order, so a later list_sort only sorts the
+ * rest and appends it.  k of the list size or more sorts the whole list.
+ */
+void list_partial_sort(list_t *list_ptr, int k)
+{
+    select_entry_t *heap, entry;
+    list_node_t *node, *first;
+    int i, pos = 0;
+
+    assert(list_ptr != NULL && list_ptr->comp_proc != NULL && k >= 0);
+    if(k >= list_ptr->current_list_size)
+    {
+        list_sort(list_ptr);
+        return;
+    }
+    if(k == 0 || list_ptr->list_sorted_state == SORTED_LIST)
+        return;
+
+    STATS_BEGIN(list_ptr, LIST_OP_SORT);
+    heap = (select_entry_t *) malloc(k * sizeof(select_entry_t));
+    assert(heap != NULL);
+    for(node = list_ptr->head->next; node != list_ptr->tail; node = node->next)
+    {
+        entry.node = node;
+        entry.pos = pos++;
+        if(pos <= k)
+        {
+            heap[pos - 1] = entry;
+            if(pos == k)
+                for(i = k / 2 - 1; i >= 0; i--)
+                    select_sift(list_ptr->comp_proc, heap, k, i);
+        }
+        else if(select_before(list_ptr->comp_proc, &entry, &heap[0]))
+        {
+            heap[0] = entry;
+            select_sift(list_ptr->comp_proc, heap, k, 0);
+        }
+    }
+    select_heap_sort(list_ptr->comp_proc, heap, k);
+
+    //Move the winners to the front, the last one first, each in front of
+    //the one moved before it
+    first = list_ptr->head->next;
+    for(i = k - 1; i >= 0; i--)
+    {
+        node = heap[i].node;
+        if(node != first)
+        {
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            node->next = first;
+            node->prev = first->prev;
+            first->prev->next = node;
+            first->prev = node;
+        }
+        first = node;
+    }
+
+    list_ptr->list_sorted_state = UNSORTED_LIST;
+    list_ptr->sorted_tail = heap[k - 1].node;
+    list_index_stale(list_ptr);
+    free(heap);
+    STATS_END(list_ptr, LIST_OP_SORT);
+}
+
+/* Returns the node of the element that a stable sort would put at position
+ * n, counting from 0, without changing the list.  A sorted list is simply
+ * indexed (see list_at).  Otherwise the nodes are gathered into an array and
+ * the element is found by introselect: quickselect with a median of three
+ * pivot, which turns to a heap sort of what is left if it partitions badly
+ * too often, so it takes O(n) comparisons on average and O(n log n) at worst.
+ */
+list_node_t * list_nth_element(list_t *list_ptr, int n)
+{
+    select_entry_t *entries;
+    list_node_t *node;
+    int lo, hi, p, depth = 0, count;
+
+    assert(list_ptr != NULL && list_ptr->comp_proc != NULL);
+    count = list_ptr->current_list_size;
+    assert(n >= 0 && n < count);
+    if(list_ptr->list_sorted_state == SORTED_LIST)
+        return list_at(list_ptr, n);
+    STATS_BEGIN(list_ptr, LIST_OPS);
+
+    entries = (select_entry_t *) malloc(count * sizeof(select_entry_t));
+    assert(entries != NULL);
+    node = list_ptr->head->next;
+    for(p = 0; p < count; p++)
+    {
+        entries[p].node = node;
+        entries[p].pos = p;
+        node = node->next;
+    }
+    for(p = count; p > 1; p /= 2)
+        depth += 2;
+
+    lo = 0;
+    hi = count - 1;
+    while(lo < hi)
+    {
+        if(depth-- == 0)
+        {
+            select_heap_sort(list_ptr->comp_proc, entries + lo, hi - lo + 1);
+            break;
+        }
+        p = select_partition(list_ptr->comp_proc, entries, lo, hi);
+        if(n < p)
+            hi = p - 1;
+        else if(n > p)
+            lo = p + 1;
+        else
+            break;
+    }
+    node = entries[n].node;
+    free(entries);
+    STATS_END(list_ptr, LIST_OPS);
+    return node;
+}
+
+/* Returns 1 if entry a goes before entry b in a stable sort: its element
+ * ranks earlier, or equal and it comes first in the list.
+ */
+static int select_before(comparer comp_proc, select_entry_t *a,
+        select_entry_t *b)
+{
+    int c = COMPARE(comp_proc, a->node->data_ptr, b->node->data_ptr);
+
+    return c == 1 || (c == 0 && a->pos < b->pos);
+}
+
+/* Moves entry at of the heap down to its place.  The heap keeps the entry
+ * that goes last on top.
+ */
+static void select_sift(comparer comp_proc, select_entry_t *heap, int size,
+        int at)
+{
+    select_entry_t top = heap[at];
+    int child;
+
+    for(; (child = 2 * at + 1) < size; at = child)
+    {
+        if(child + 1 < size &&
+                select_before(comp_proc, &heap[child], &heap[child + 1]))
+            child++;
+        if(!select_before(comp_proc, &top, &heap[child]))
+            break;
+        heap[at] = heap[child];
+    }
+    heap[at] = top;
+}
+
+/* Sorts the entries into stable sort order, in place */
+static void select_heap_sort(comparer comp_proc, select_entry_t *entries,
+        int count)
+{
+    select_entry_t swap;
+    int i;
+
+    for(i = count / 2 - 1; i >= 0; i--)
+        select_sift(comp_proc, entries, count, i);
+    for(i = count - 1; i > 0; i--)
+    {
+        swap = entries[0];
+        entries[0] = entries[i];
+        entries[i] = swap;
+        select_sift(comp_proc, entries, i, 0);
+    }
+}
+
+/* Partitions entries[lo..hi] around the median of the first, middle and last
+ * entry and returns the pivot's final index: the entries before it go before
+ * it in a stable sort, the ones after it after it.
+ */
+static int select_partition(comparer comp_proc, select_entry_t *entries,
+        int lo, int hi)
+{
+    select_entry_t swap, pivot;
+    int mid = lo + (hi - lo) / 2, i, store;
+
+    //Order the three samples, leaving the median at hi
+    if(select_before(comp_proc, &entries[mid], &entries[lo]))
+    {
+        swap = entries[mid];
+        entries[mid] = entries[lo];
+        entries[lo] = swap;
+    }
+    if(select_before(comp_proc, &entries[hi], &entries[lo]))
+    {
+        swap = entries[hi];
+        entries[hi] = entries[lo];
+        entries[lo] = swap;
+    }
+    if(select_before(comp_proc, &entries[mid], &entries[hi]))
+    {
+        swap = entries[mid];
+        entries[mid] = entries[hi];
+        entries[hi] = swap;
+    }
+
+    pivot = entries[hi];
+    store = lo;
+    for(i = lo; i < hi; i++)
+    {
+        if(select_before(comp_proc, &entries[i], &pivot))
+        {
+            swap = entries[i];
+            entries[i] = entries[store];
+            entries[store] = swap;
+            store++;
+        }
+    }
+    entries[hi] = entries[store];
+    entries[store] = pivot;
+    return store;
+}
+
+/* Stable insertion sort of a short array */
+static void array_insertion_sort(comparer comp_proc, void **elems, int count)
+{
+    void *elem;
+    int i, j;
+
+    for(i = 1; i < count; i++)
+    {
+        elem = elems[i];
+        for(j = i; j > 0 && COMPARE(comp_proc, elems[j - 1], elem) == -1; j--)
+        {
+            elems[j] = elems[j - 1];
+        }
+        elems[j] = elem;
+    }
+}
+
+/* Merges the sorted ranges src[lo..mid) and src[mid..hi) into dst[lo..hi).
+ * Ties are taken from the left range first.
+ */
+static void array_merge(comparer comp_proc, void **src, int lo, int mid,
+        int hi, void **dst)
+{
+    int i = lo, j = mid, k = lo;
+
+    //Ranges already in order are just copied
+    if(mid < hi && COMPARE(comp_proc, src[mid - 1], src[mid]) != -1)
+    {
+        memcpy(dst + lo, src + lo, (hi - lo) * sizeof(void *));
+        return;
+    }
+    while(i < mid && j < hi)
+    {
+        if(COMPARE(comp_proc, src[i], src[j]) != -1)
+            dst[k++] = src[i++];
+        else
+            dst[k++] = src[j++];
+    }
+    while(i < mid)
+        dst[k++] = src[i++];
+    while(j < hi)
+        dst[k++] = src[j++];
+}
+
+/* Sorts the list like list_sort, using up to nthreads threads.
+ *
+ * The chain is cut into one segment per thread, the segments are sorted
+ * concurrently with the same bottom-up merge sort as list_sort, and the
+ * sorted segments are then merged pairwise in a tree, each round of merges
+ * also running concurrently.  Segments are always merged left into right so
+ * the result is stable and identical to the one list_sort produces.
+ *
+ * Lists shorter than PARALLEL_SORT_MIN, or nthreads < 2, are simply sorted
+ * with list_sort.  The comparison function is called from several threads at
+ * once and must be safe to do so.
+ */
+void list_sort_parallel(list_t *list_ptr, int nthreads)
+{
+    sort_task_t tasks[PARALLEL_MAX_THREADS];
+    list_node_t *runs[PARALLEL_MAX_THREADS];
+    list_node_t *current, *last;
+    int segments, i, j, k;
+
+    assert(list_ptr != NULL && list_ptr->comp_proc != NULL);
+
+    //list_sort counts the sorts it does itself
+    segments = list_ptr->current_list_size / PARALLEL_SEGMENT_MIN;
+    if(segments > nthreads)
+        segments = nthreads;
+    if(segments > PARALLEL_MAX_THREADS)
+        segments = PARALLEL_MAX_THREADS;
+    if(segments < 2 || list_ptr->current_list_size < PARALLEL_SORT_MIN)
+    {
+        list_sort(list_ptr);
+        return;
+    }
+    STATS_BEGIN(list_ptr, LIST_OP_SORT);
+
+    //Cut the chain into segments of (nearly) equal length
+    current = list_ptr->head->next;
+    for(i = 0; i < segments; i++)
+    {
+        tasks[i].comp_proc = list_ptr->comp_proc;
+        tasks[i].chain_l = current;
+        tasks[i].chain_r = NULL;
+        k = list_ptr->current_list_size / segments +
+            (i < list_ptr->current_list_size % segments);
+        for(j = 1; j < k; j++)
+        {
+            current = current->next;
+        }
+        last = current;
+        current = current->next;
+        last->next = NULL;
+    }
+    assert(current == list_ptr->tail);
+
+    run_workers(segments, sort_task_run, tasks, sizeof(sort_task_t));
+    for(i = 0; i < segments; i++)
+    {
+        STATS_ADD(list_ptr, compares, tasks[i].compares);
+    }
+
+    //Merge neighbouring segments pairwise until only one is left
+    for(i = 0; i < segments; i++)
+    {
+        runs[i] = tasks[i].result;
+    }
+    while(segments > 1)
+    {
+        k = segments / 2;
+        for(i = 0; i < k; i++)
+        {
+            tasks[i].chain_l = runs[2 * i];
+            tasks[i].chain_r = runs[2 * i + 1];
+        }
+        run_workers(k, sort_task_run, tasks, sizeof(sort_task_t));
+        for(i = 0; i < k; i++)
+        {
+            runs[i] = tasks[i].result;
+            STATS_ADD(list_ptr, compares, tasks[i].compares);
+        }
+        if(segments % 2 == 1)
+        {
+            runs[k] = runs[segments - 1];
+            k++;
+        }
+        segments = k;
+    }
+
+    relink_chain(list_ptr, runs[0]);
+    STATS_END(list_ptr, LIST_OP_SORT);
+    list_mark_sorted(list_ptr);
+}
+
+/* Worker body for list_sort_parallel */
+static void *sort_task_run(void *arg)
+{
+    sort_task_t *task = (sort_task_t *) arg;
+#ifdef LIST_STATS
+    unsigned long long mark = thread_compares;
+#endif
+
+    if(task->chain_r == NULL)
+    {
+        task->result = sort_chain(task->comp_proc, task->chain_l);
+    }
+    else
+    {
+        task->result = merge_chains(task->comp_proc, task->chain_l, task->chain_r);
+    }
+
+#ifdef LIST_STATS
+    //The comparisons are counted on the task, which may have run on the
+    //calling thread, and list_sort_parallel adds them to the list
+    task->compares = thread_compares - mark;
+    thread_compares = mark;
+#endif
+    return NULL;
+}
+
+/* Runs work on each of the nworkers tasks laid out task_size bytes apart,
+ * one thread per task, and waits for all of them.  The calling thread takes
+ * the first task itself.  If a thread cannot be started its task is run on
+ * the calling thread instead, so the work always gets done.
+ */
+static void run_workers(int nworkers, void *(*work)(void *), void *tasks,
+        size_t task_size)
+{
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int started[PARALLEL_MAX_THREADS];
+    int i;
+
+    assert(nworkers <= PARALLEL_MAX_THREADS);
+    for(i = 1; i < nworkers; i++)
+    {
+        started[i] = pthread_create(&threads[i], NULL, work,
+                (char *) tasks + i * task_size) == 0;
+    }
+    if(nworkers > 0)
+    {
+        work(tasks);
+    }
+    for(i = 1; i < nworkers; i++)
+    {
+        if(started[i])
+            pthread_join(threads[i], NULL);
+        else
+            work((char *) tasks + i * task_size);
+    }
+}
+
+/* Calls visit_proc(elem, arg) for every element of the list, using up to
+ * nthreads threads.
+ *
+ * The nodes are gathered into an array, which is cut into one slice of
+ * consecutive elements per thread (each at least PARALLEL_VISIT_MIN long),
+ * and each thread works through its slice in list order, prefetching the
+ * elements VISIT_PREFETCH ahead.  With nthreads < 2 or a short list all of
+ * it runs on the calling thread.  Callbacks of the same call run
+ * concurrently and must be safe to do so, and must not change elements in
+ * ways that move them in the order of the list.
+ */
+void list_foreach(list_t *list_ptr, visitor visit_proc, void *arg, int nthreads)
+{
+    visit_task_t proto, tasks[PARALLEL_MAX_THREADS];
+    list_node_t **nodes;
+
+    assert(list_ptr != NULL && visit_proc != NULL);
+    memset(&proto, 0, sizeof(visit_task_t));
+    proto.visit_proc = visit_proc;
+    proto.arg = arg;
+    visit_run(list_ptr, &proto, nthreads, tasks, &nodes);
+    free(nodes);
+}
+
+/* Replaces every element of the list with map_proc(elem, arg), like
+ * list_foreach with up to nthreads threads.  map_proc must not return NULL;
+ * it may return elem itself after changing it, or a new element, in which
+ * case disposing of the old one is up to it.  The list is no longer taken to
+ * be sorted afterwards.  Not for intrusive lists, whose elements own their
+ * nodes.
+ */
+void list_map_inplace(list_t *list_ptr, mapper map_proc, void *arg, int nthreads)
+{
+    visit_task_t proto, tasks[PARALLEL_MAX_THREADS];
+    list_node_t **nodes;
+
+    assert(list_ptr != NULL && map_proc != NULL && list_ptr->link_offset < 0);
+    memset(&proto, 0, sizeof(visit_task_t));
+    proto.map_proc = map_proc;
+    proto.arg = arg;
+    visit_run(list_ptr, &proto, nthreads, tasks, &nodes);
+    free(nodes);
+
+    if(list_ptr->current_list_size > 0)
+    {
+        list_ptr->list_sorted_state = UNSORTED_LIST;
+        list_ptr->sorted_tail = list_ptr->head;
+        list_ptr->finger = NULL;
+        list_index_stale(list_ptr);
+    }
+}
+
+/* Keeps the elements for which keep_proc(elem, arg) returns nonzero and
+ * moves the others, in their order, to a new list that is returned, like
+ * list_remove_range.  keep_proc runs on up to nthreads threads like the
+ * callback of list_foreach; the list is then relinked in a single pass on the
+ * calling thread.  Both lists stay as sorted as the list was.
+ */
+list_t * list_filter(list_t *list_ptr, predicate keep_proc, void *arg,
+        int nthreads)
+{
+    visit_task_t proto, tasks[PARALLEL_MAX_THREADS];
+    list_node_t **nodes, *node, *kept_tail, *dropped_tail;
+    list_node_t *kept_prefix, *dropped_prefix;
+    list_t *removed;
+    char *keep;
+    int count, i, dropped = 0, in_prefix;
+
+    assert(list_ptr != NULL && keep_proc != NULL);
+    count = list_ptr->current_list_size;
+    removed = list_construct_shared(list_ptr);
+    removed->comp_proc = list_ptr->comp_proc;
+    removed->list_sorted_state = list_ptr->list_sorted_state;
+    if(count == 0)
+        return removed;
+
+    keep = (char *) malloc(count);
+    assert(keep != NULL);
+    memset(&proto, 0, sizeof(visit_task_t));
+    proto.keep_proc = keep_proc;
+    proto.arg = arg;
+    proto.keep = keep;
+    visit_run(list_ptr, &proto, nthreads, tasks, &nodes);
+
+    //Deal the nodes out to the two lists, noting where the sorted prefix of
+    //an unsorted list ends in each of them
+    in_prefix = list_ptr->list_sorted_state == UNSORTED_LIST &&
+        list_ptr->sorted_tail != list_ptr->head;
+    kept_tail = kept_prefix = list_ptr->head;
+    dropped_tail = dropped_prefix = removed->head;
+    for(i = 0; i < count; i++)
+    {
+        node = nodes[i];
+        if(keep[i])
+        {
+            kept_tail->next = node;
+            node->prev = kept_tail;
+            kept_tail = node;
+        }
+        else
+        {
+            dropped_tail->next = node;
+            node->prev = dropped_tail;
+            dropped_tail = node;
+            dropped++;
+        }
+        if(in_prefix)
+        {
+            kept_prefix = kept_tail;
+            dropped_prefix = dropped_tail;
+            in_prefix = node != list_ptr->sorted_tail;
+        }
+    }
+    kept_tail->next = list_ptr->tail;
+    list_ptr->tail->prev = kept_tail;
+    dropped_tail->next = removed->tail;
+    removed->tail->prev = dropped_tail;
+    free(nodes);
+    free(keep);
+
+    list_ptr->current_list_size -= dropped;
+    removed->current_list_size = dropped;
+    if(list_ptr->list_sorted_state == UNSORTED_LIST)
+    {
+        //Either list is sorted if nothing after its prefix went to it
+        list_ptr->sorted_tail = kept_prefix;
+        if(kept_prefix == kept_tail)
+            list_ptr->list_sorted_state = SORTED_LIST;
+        removed->sorted_tail = dropped_prefix;
+        if(dropped_prefix == dropped_tail)
+            removed->list_sorted_state = SORTED_LIST;
+    }
+    if(dropped > 0)
+    {
+        list_ptr->finger = NULL;
+        list_index_stale(list_ptr);
+    }
+    return removed;
+}
+
+/* Folds the elements of the list into the accumulator at acc, which holds
+ * acc_size bytes, using up to nthreads threads like list_foreach.
+ *
+ * Each slice starts from a copy of *acc and calls reduce_proc(slice_acc,
+ * elem, arg) for its elements in list order; the slice accumulators are then
+ * folded into *acc from left to right with combine_proc(acc, slice_acc, arg).
+ * *acc must therefore start out as the identity of combine_proc.  The result
+ * is the same for any nthreads as long as combine_proc is associative, and
+ * otherwise the same for the same nthreads and list length.
+ */
+void list_reduce(list_t *list_ptr, void *acc, size_t acc_size,
+        reducer reduce_proc, combiner combine_proc, void *arg, int nthreads)
+{
+    visit_task_t proto, tasks[PARALLEL_MAX_THREADS];
+    list_node_t **nodes;
+    char *accs;
+    int segments, i;
+
+    assert(list_ptr != NULL && acc != NULL && reduce_proc != NULL);
+    assert(combine_proc != NULL);
+    accs = (char *) malloc(acc_size * PARALLEL_MAX_THREADS);
+    assert(accs != NULL);
+    for(i = 0; i < PARALLEL_MAX_THREADS; i++)
+        memcpy(accs + i * acc_size, acc, acc_size);
+
+    memset(&proto, 0, sizeof(visit_task_t));
+    proto.reduce_proc = reduce_proc;
+    proto.arg = arg;
+    proto.acc = accs;
+    proto.acc_size = acc_size;
+    segments = visit_run(list_ptr, &proto, nthreads, tasks, &nodes);
+    free(nodes);
+
+    for(i = 0; i < segments; i++)
+        combine_proc(acc, accs + i * acc_size, arg);
+    free(accs);
+}
+
+/* Gathers the nodes of the list into *nodes (freed by the caller), cuts the
+ * array into slices and runs one copy of proto per slice on up to nthreads
+ * threads.  The keep flags and the accumulators of proto are laid out for
+ * the whole list and handed out slice by slice.  Returns the number of
+ * slices, 0 for an empty list.
+ */
+static int visit_run(list_t *list_ptr, visit_task_t *proto, int nthreads,
+        visit_task_t *tasks, list_node_t ***nodes)
+{
+    list_node_t *node;
+    int count = list_ptr->current_list_size;
+    int segments, i, start;
+
+    *nodes = NULL;
+    if(count == 0)
+        return 0;
+    *nodes = (list_node_t **) malloc(count * sizeof(list_node_t *));
+    assert(*nodes != NULL);
+    node = list_ptr->head->next;
+    for(i = 0; i < count; i++)
+    {
+        (*nodes)[i] = node;
+        node = node->next;
+    }
+
+    segments = count / PARALLEL_VISIT_MIN;
+    if(segments > nthreads)
+        segments = nthreads;
+    if(segments > PARALLEL_MAX_THREADS)
+        segments = PARALLEL_MAX_THREADS;
+    if(segments < 1)
+        segments = 1;
+
+    start = 0;
+    for(i = 0; i < segments; i++)
+    {
+        tasks[i] = *proto;
+        tasks[i].nodes = *nodes + start;
+        tasks[i].count = count / segments + (i < count % segments);
+        if(proto->keep != NULL)
+            tasks[i].keep = proto->keep + start;
+        if(proto->acc != NULL)
+            tasks[i].acc = (char *) proto->acc + i * proto->acc_size;
+        start += tasks[i].count;
+    }
+    run_workers(segments, visit_task_run, tasks, sizeof(visit_task_t));
+    return segments;
+}
+
+/* Worker body for visit_run: calls the callback of the task on its slice */
+static void *visit_task_run(void *arg)
+{
+    visit_task_t *task = (visit_task_t *) arg;
+    list_node_t **nodes = task->nodes;
+    void *elem_ptr;
+    int i;
+
+    for(i = 0; i < task->count; i++)
+    {
+        //The array is read in order, but the nodes and the elements are
+        //scattered, so fetch the node two strides ahead and the element of
+        //the node one stride ahead
+        if(i + 2 * VISIT_PREFETCH < task->count)
+            __builtin_prefetch(nodes[i + 2 * VISIT_PREFETCH]);
+        if(i + VISIT_PREFETCH < task->count)
+            __builtin_prefetch(nodes[i + VISIT_PREFETCH]->data_ptr);
+
+        elem_ptr = nodes[i]->data_ptr;
+        if(task->visit_proc != NULL)
+        {
+            task->visit_proc(elem_ptr, task->arg);
+        }
+        else if(task->map_proc != NULL)
+        {
+            nodes[i]->data_ptr = task->map_proc(elem_ptr, task->arg);
+            assert(nodes[i]->data_ptr != NULL);
+        }
+        else if(task->keep_proc != NULL)
+        {
+            task->keep[i] = task->keep_proc(elem_ptr, task->arg) != 0;
+        }
+        else
+        {
+            task->reduce_proc(task->acc, elem_ptr, task->arg);
+        }
+    }
+    return NULL;
+}
+
+void insert_sort(list_t *list_ptr)
+{
+    list_t *list_2;
+    
+    list_2 = list_construct_shared(list_ptr);
+    set_comp(list_2, list_ptr->comp_proc);
+    
+    do
+    {
+        list_insert_sorted(list_2, list_remove(list_ptr, list_ptr->head->next));
+    }
+    while(list_ptr->current_list_size != 0);
+    
+    list_ptr->head->next = list_2->head->next;
+    list_2->head->next->prev = list_ptr->head;
+    list_ptr->tail->prev = list_2->tail->prev;
+    list_2->tail->prev->next = list_ptr->tail;
+    list_ptr->current_list_size = list_2->current_list_size;
+    list_index_stale(list_ptr);
+    
+    list_free_header(list_2);
+}
+
+void recursive_select_sort(list_t *list_ptr, Iterator min, Iterator max)
+{
+    Iterator maxpos;
+    Iterator hold_min;
+    void *hold;
+    
+    if(min != max->prev)
+    {
+        maxpos = find_max(list_ptr, min, max->prev);
+        if(maxpos != min)
+        {
+            hold_min = min;
+            min = min->prev;
+            hold = list_remove(list_ptr, hold_min);
+            list_insert(list_ptr, hold, maxpos);
+            hold = list_remove(list_ptr, maxpos);
+            min = min->next;
+            list_insert(list_ptr, hold, min);
+        }
+        else
+        {
+            min = min->next;
+        }
+        
+        recursive_select_sort(list_ptr, min, max);
+    }
+}
+
+void iter_select_sort(list_t *list_ptr, Iterator min, Iterator max)
+{
+    Iterator maxpos;
+    Iterator hold_min;
+    void *hold;
+    
+    while(min != max->prev)
+    {
+        maxpos = find_max(list_ptr, min, max->prev);
+        
+        if(maxpos != min)
+        {
+            hold_min = min;
+            min = min->prev;
+            hold = list_remove(list_ptr, hold_min);
+            list_insert(list_ptr, hold, maxpos);
+            hold = list_remove(list_ptr, maxpos);
+            min = min->next;
+            list_insert(list_ptr, hold, min);
+        }
+        else
+        {
+            min = min->next;
+        }
+        
+    }
+}
+
+/* Bottom-up merge sort over the raw next chain of the list.
+ *
+ * The chain is detached from the dummy head and tail and sorted as a NULL
+ * terminated singly linked chain, so no list headers are built and nothing is
+ * allocated.  Runs of 1, 2, 4, ... nodes are kept in bins, one run per bin,
+ * like the digits of a binary counter; pushing a node carries merges upward.
+ * The prev links are only fixed up once, when the sorted chain is relinked.
+ *
+ * The sort is stable: elements of equal rank keep their relative order.
+ */
+void merge_sort(list_t *list_ptr)
+{
+    list_node_t *chain;
+
+    if(list_ptr->current_list_size > 1)
+    {
+        //Detach the chain from the dummy nodes
+        chain = list_ptr->head->next;
+        list_ptr->tail->prev->next = NULL;
+
+        chain = sort_chain(list_ptr->comp_proc, chain);
+        relink_chain(list_ptr, chain);
+    }
+}
+
+/* Sorts a NULL terminated chain linked through next only and returns its new
+ * first node.  The prev links of the result are not valid.
+ */
+static list_node_t *sort_chain(comparer comp_proc, list_node_t *chain)
+{
+    list_node_t *bins[MERGE_BINS];
+    list_node_t *run;
+    int i, used = 0;
+
+    while(chain != NULL)
+    {
+        //Take a single node off the chain as a run of length one
+        run = chain;
+        chain = chain->next;
+        run->next = NULL;
+
+        //Carry: merge with every full bin below the first empty one.  The
+        //run in a bin always holds earlier elements than the new run.
+        for(i = 0; i < used && bins[i] != NULL; i++)
+        {
+            run = merge_chains(comp_proc, bins[i], run);
+            bins[i] = NULL;
+        }
+        if(i == used)
+        {
+            assert(used < MERGE_BINS);
+            used++;
+        }
+        bins[i] = run;
+    }
+
+    //Fold the partial bins together, later runs into earlier ones
+    run = NULL;
+    for(i = 0; i < used; i++)
+    {
+        if(bins[i] != NULL)
+        {
+            run = run == NULL ? bins[i] : merge_chains(comp_proc, bins[i], run);
+        }
+    }
+    return run;
+}
+
+/* Merges two sorted NULL terminated chains and returns the first node of the
+ * result.  On ties the node from chain_l goes first, which keeps the sort
+ * stable as long as chain_l holds the earlier elements.
+ */
+static list_node_t *merge_chains(comparer comp_proc, list_node_t *chain_l,
+        list_node_t *chain_r)
+{
+    list_node_t *first;
+    list_node_t **link = &first;
+
+    while(chain_l != NULL && chain_r != NULL)
+    {
+        if(COMPARE(comp_proc, chain_l->data_ptr, chain_r->data_ptr) != -1)
+        {
+            *link = chain_l;
+            link = &chain_l->next;
+            chain_l = chain_l->next;
+        }
+        else
+        {
+            *link = chain_r;
+            link = &chain_r->next;
+            chain_r = chain_r->next;
+        }
+    }
+    *link = chain_l != NULL ? chain_l : chain_r;
+    return first;
+}
+
+/* Hangs a NULL terminated chain between the dummy head and tail of the list,
+ * setting every prev link along the way.  The chain must hold exactly the
+ * current_list_size elements of the list.
+ */
+static void relink_chain(list_t *list_ptr, list_node_t *chain)
+{
+    list_node_t *prev = list_ptr->head;
+
+    while(chain != NULL)
+    {
+        prev->next = chain;
+        chain->prev = prev;
+        prev = chain;
+        chain = chain->next;
+    }
+    prev->next = list_ptr->tail;
+    list_ptr->tail->prev = prev;
+}
+        
+
+/* Adaptive natural merge sort over the raw next chain of the list.
+ *
+ * One pass over the chain splits it into the runs that are already there:
+ * non-descending runs are taken as they are and strictly descending runs are
+ * reversed in place, and runs shorter than MIN_RUN are extended with the
+ * nodes that follow and sorted with sort_chain.  The runs go on a stack that is merged following the
+ * timsort rules (the run lengths shrink at least like the Fibonacci numbers
+ * from the bottom of the stack up), so merges stay balanced.  Two runs that
+ * are already in order are joined with a single comparison, and a merge that
+ * keeps taking from the same side switches to galloping: it probes that side
+ * at distances 1, 2, 4, ... and binary searches the last gap, taking the
+ * whole stretch in O(log k) comparisons.
+ *
+ * A list that is sorted, reverse sorted, or made of a few sorted pieces is
+ * sorted with close to n comparisons.  The sort is stable and allocates
+ * nothing.
+ */
+void natural_sort(list_t *list_ptr)
+{
+    comparer comp_proc = list_ptr->comp_proc;
+    run_t runs[RUN_STACK];
+    list_node_t *chain, *first, *last, *next;
+    int count = 0, length, i;
+
+    if(list_ptr->current_list_size < 2)
+        return;
+
+    chain = list_ptr->head->next;
+    list_ptr->tail->prev->next = NULL;
+
+    while(chain != NULL)
+    {
+        //Find the next run
+        first = chain;
+        last = chain;
+        length = 1;
+        chain = chain->next;
+        if(chain != NULL && COMPARE(comp_proc, last->data_ptr, chain->data_ptr) == -1)
+        {
+            //Strictly descending, reverse it while walking
+            first->next = NULL;
+            while(chain != NULL && COMPARE(comp_proc, first->data_ptr, chain->data_ptr) == -1)
+            {
+                next = chain->next;
+                chain->next = first;
+                first = chain;
+                chain = next;
+                length++;
+            }
+        }
+        else
+        {
+            while(chain != NULL && COMPARE(comp_proc, last->data_ptr, chain->data_ptr) != -1)
+            {
+                last = chain;
+                chain = chain->next;
+                length++;
+            }
+            last->next = NULL;
+        }
+
+        //Extend a short run to MIN_RUN nodes and sort it, so random input
+        //does not end up merging runs of one or two nodes
+        if(length < MIN_RUN && chain != NULL)
+        {
+            last->next = chain;
+            while(length < MIN_RUN && chain != NULL)
+            {
+                last = chain;
+                chain = chain->next;
+                length++;
+            }
+            last->next = NULL;
+            first = sort_chain(comp_proc, first);
+            for(last = first; last->next != NULL; last = last->next)
+                ;
+        }
+
+        assert(count < RUN_STACK);
+        runs[count].first = first;
+        runs[count].last = last;
+        runs[count].length = length;
+        count++;
+
+        //Restore the invariants on the run lengths
+        while(count > 1)
+        {
+            i = count - 2;
+            if((i > 0 && runs[i - 1].length <= runs[i].length + runs[i + 1].length) ||
+               (i > 1 && runs[i - 2].length <= runs[i - 1].length + runs[i].length))
+            {
+                if(runs[i - 1].length < runs[i + 1].length)
+                    i--;
+            }
+            else if(runs[i].length > runs[i + 1].length)
+            {
+                break;
+            }
+            natural_merge_at(comp_proc, runs, i);
+            for(i++; i < count - 1; i++)
+                runs[i] = runs[i + 1];
+            count--;
+        }
+    }
+
+    while(count > 1)
+    {
+        natural_merge_at(comp_proc, runs, count - 2);
+        count--;
+    }
+    relink_chain(list_ptr, runs[0].first);
+}
+
+/* Merges run i + 1 into run i on the natural_sort stack */
+static void natural_merge_at(comparer comp_proc, run_t *runs, int i)
+{
+    run_t *run_l = &runs[i], *run_r = &runs[i + 1];
+
+    if(COMPARE(comp_proc, run_l->last->data_ptr, run_r->first->data_ptr) != -1)
+    {
+        //Already in order
+        run_l->last->next = run_r->first;
+        run_l->last = run_r->last;
+    }
+    else
+    {
+        run_l->first = merge_runs(comp_proc, run_l->first, run_r->first,
+                &run_l->last);
+        if(run_l->last == NULL)
+            run_l->last = run_r->last;
+    }
+    run_l->length += run_r->length;
+}
+
+/* Merges two sorted NULL terminated chains like merge_chains, galloping once
+ * one side has won MIN_GALLOP times in a row.  *last is set to the last node
+ * of the result if it came from chain_l, to NULL if it came from chain_r.
+ */
+static list_node_t *merge_runs(comparer comp_proc, list_node_t *chain_l,
+        list_node_t *chain_r, list_node_t **last)
+{
+    list_node_t *first, *stretch;
+    list_node_t **link = &first;
+    int wins_l = 0, wins_r = 0;
+    int taken_l, taken_r;
+
+    while(chain_l != NULL && chain_r != NULL)
+    {
+        if(wins_l >= MIN_GALLOP || wins_r >= MIN_GALLOP)
+        {
+            //Take every node of chain_l not greater than the head of chain_r
+            taken_l = gallop_chain(comp_proc, chain_l, chain_r->data_ptr, 0, &stretch);
+            if(taken_l > 0)
+            {
+                *link = chain_l;
+                link = &stretch->next;
+                chain_l = stretch->next;
+                if(chain_l == NULL)
+                    break;
+            }
+            //Then every node of chain_r less than the head of chain_l
+            taken_r = gallop_chain(comp_proc, chain_r, chain_l->data_ptr, 1, &stretch);
+            if(taken_r > 0)
+            {
+                *link = chain_r;
+                link = &stretch->next;
+                chain_r = stretch->next;
+            }
+            //Short stretches mean the runs interleave again
+            if(taken_l < MIN_GALLOP && taken_r < MIN_GALLOP)
+                wins_l = wins_r = 0;
+        }
+        else if(COMPARE(comp_proc, chain_l->data_ptr, chain_r->data_ptr) != -1)
+        {
+            *link = chain_l;
+            link = &chain_l->next;
+            chain_l = chain_l->next;
+            wins_l++;
+            wins_r = 0;
+        }
+        else
+        {
+            *link = chain_r;
+            link = &chain_r->next;
+            chain_r = chain_r->next;
+            wins_r++;
+            wins_l = 0;
+        }
+    }
+
+    if(chain_l != NULL)
+    {
+        *link = chain_l;
+        while(chain_l->next != NULL)
+            chain_l = chain_l->next;
+        *last = chain_l;
+    }
+    else
+    {
+        *link = chain_r;
+        *last = NULL;
+    }
+    return first;
+}
+
+/* Counts the leading nodes of a sorted NULL terminated chain that go before
+ * key: nodes less than key if strict is set, not greater than key otherwise.
+ * *last_before is set to the last such node.
+ *
+ * The chain is probed at positions 0, 1, 3, 7, ... until a node is found that
+ * does not go before key, and the gap since the previous probe is then binary
+ * searched.  That takes O(log k) comparisons for a count of k, at the price
+ * of walking the gap a second time.
+ */
+static int gallop_chain(comparer comp_proc, list_node_t *chain, void *key,
+        int strict, list_node_t **last_before)
+{
+    list_node_t *node = chain, *base;
+    int lo = 0, hi, pos = 0, step = 1, mid, i, rank;
+
+    //Exponential search: nodes before index lo are known to go before key,
+    //the node at index hi (or the end of the chain) is known not to
+    *last_before = NULL;
+    for(;;)
+    {
+        if(node == NULL)
+            break;
+        rank = COMPARE(comp_proc, node->data_ptr, key);
+        if(rank == -1 || (rank == 0 && strict))
+            break;
+        *last_before = node;
+        lo = pos + 1;
+        for(i = 0; i < step && node != NULL; i++)
+        {
+            node = node->next;
+            pos++;
+        }
+        step *= 2;
+    }
+    hi = pos;
+
+    //Binary search of the gap, walking to each midpoint
+    base = *last_before != NULL ? (*last_before)->next : chain;
+    while(lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        node = base;
+        for(i = lo; i < mid; i++)
+            node = node->next;
+        rank = COMPARE(comp_proc, node->data_ptr, key);
+        if(rank == -1 || (rank == 0 && strict))
+        {
+            hi = mid;
+        }
+        else
+        {
+            *last_before = node;
+            base = node->next;
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+Iterator find_max(list_t *list_ptr, Iterator min, Iterator max)
+{
+    Iterator i = min;
+    Iterator j = min;
+    //int k = 0;
+       
+    do{
+        /*printf("K: %d\n", k);
+        k++;*/
+        i = i->next;
+        if(COMPARE(list_ptr->comp_proc, i->data_ptr, j->data_ptr) == 1)
+        {
+            j = i;
+        }
+    }while(i != max);
+    
+    return j;
+}
+/* Marks the list as sorted at the end of a sort and rebuilds the indexes
+ * that depend on the order of the list.
+ */
+static void list_mark_sorted(list_t *list_ptr)
+{
+    list_ptr->list_sorted_state = SORTED_LIST;
+    list_index_stale(list_ptr);
+    if(list_ptr->skip_index != NULL)
+        skip_rebuild(list_ptr);
+    list_debug_validate(list_ptr);
+}
+
+/* Turns the skip list index of a list on (enable != 0) or off.
+ *
+ * While the list is sorted the index lets list_insert_sorted and
+ * list_elem_find find their position in O(log n) comparisons instead of
+ * walking the list from the front.  A hash index or key column, if the list
+ * has one, answers list_elem_find instead.  It is kept up to date by
+ * list_insert_sorted and list_remove.  A list_insert that makes the list
+ * unsorted makes the index stale; it is rebuilt the next time the list is
+ * sorted.
+ *
+ * Maintaining the index costs list_remove O(log n) comparisons on a sorted
+ * list, and about one small allocation per SKIP_FANOUT elements.
+ */
+void list_use_skip_index(list_t *list_ptr, int enable)
+{
+    list_skip_t *skip;
+
+    assert(list_ptr != NULL);
+    if(enable && list_ptr->skip_index == NULL)
+    {
+        assert(list_ptr->comp_proc != NULL);
+        skip = (list_skip_t *) malloc(sizeof(list_skip_t));
+        assert(skip != NULL);
+        skip->head = (skip_entry_t *) calloc(1, sizeof(skip_entry_t) +
+                SKIP_MAX_LEVEL * sizeof(skip_entry_t *));
+        assert(skip->head != NULL);
+        skip->head->levels = SKIP_MAX_LEVEL;
+        skip->levels = 1;
+        skip->valid = 0;
+        skip->seed = 2463534242u;
+        list_ptr->skip_index = skip;
+        if(list_ptr->list_sorted_state == SORTED_LIST)
+            skip_rebuild(list_ptr);
+    }
+    else if(!enable && list_ptr->skip_index != NULL)
+    {
+        skip_clear(list_ptr->skip_index);
+        free(list_ptr->skip_index->head);
+        free(list_ptr->skip_index);
+        list_ptr->skip_index = NULL;
+    }
+}
+
+/* Returns 1 if the skip list index of the list can be used for searching,
+ * rebuilding it first if bulk changes to the list left it stale.
+ */
+static int skip_usable(list_t *list_ptr)
+{
+    if(list_ptr->skip_index == NULL || list_ptr->list_sorted_state != SORTED_LIST)
+        return 0;
+    if(!list_ptr->skip_index->valid)
+        skip_rebuild(list_ptr);
+    return 1;
+}
+
+/* Descends the index to the last entry whose node precedes elem_ptr, that is
+ * compares less than it when strict is set or not greater than it otherwise,
+ * and returns the node after that entry's node (the first node if there is no
+ * such entry).  The search along the list continues from there.
+ *
+ * If update is not NULL it receives the last entry visited on each level,
+ * which is where a new entry for a node inserted there must be linked.
+ */
+static list_node_t *skip_seek(list_t *list_ptr, void *elem_ptr, int strict,
+        skip_entry_t **update)
+{
+    list_skip_t *skip = list_ptr->skip_index;
+    skip_entry_t *entry = skip->head, *next;
+    int level, rank;
+
+    for(level = skip->levels - 1; level >= 0; level--)
+    {
+        next = entry->next[level];
+        while(next != NULL)
+        {
+            rank = COMPARE(list_ptr->comp_proc, next->node->data_ptr, elem_ptr);
+            if(rank == -1 || (rank == 0 && strict))
+                break;
+            entry = next;
+            next = entry->next[level];
+        }
+        if(update != NULL)
+            update[level] = entry;
+    }
+    return entry == skip->head ? list_ptr->head->next : entry->node->next;
+}
+
+/* Gives a node just inserted by list_insert_sorted an entry in the index
+ * with probability 1/SKIP_FANOUT, linking it after the entries in update as
+ * filled in by skip_seek for the same element.
+ */
+static void skip_add(list_t *list_ptr, list_node_t *node, skip_entry_t **update)
+{
+    list_skip_t *skip = list_ptr->skip_index;
+    skip_entry_t *entry;
+    int levels, i;
+
+    levels = skip_random_levels(skip);
+    if(levels == 0)
+        return;
+
+    entry = (skip_entry_t *) malloc(sizeof(skip_entry_t) +
+            levels * sizeof(skip_entry_t *));
+    assert(entry != NULL);
+    entry->node = node;
+    entry->levels = levels;
+    for(i = skip->levels; i < levels; i++)
+    {
+        update[i] = skip->head;
+    }
+    if(levels > skip->levels)
+        skip->levels = levels;
+    for(i = 0; i < levels; i++)
+    {
+        entry->next[i] = update[i]->next[i];
+        update[i]->next[i] = entry;
+    }
+}
+
+/* Removes the entry of a node that is about to be removed from the list, if
+ * it has one.  The entry is found among the entries equal in rank to the
+ * node's element.
+ */
+static void skip_drop(list_t *list_ptr, list_node_t *node)
+{
+    list_skip_t *skip = list_ptr->skip_index;
+    skip_entry_t *update[SKIP_MAX_LEVEL];
+    skip_entry_t *entry, *prev;
+    int i;
+
+    skip_seek(list_ptr, node->data_ptr, 1, update);
+
+    entry = update[0]->next[0];
+    while(entry != NULL && entry->node != node &&
+            COMPARE(list_ptr->comp_proc, entry->node->data_ptr, node->data_ptr) == 0)
+    {
+        entry = entry->next[0];
+    }
+    if(entry == NULL || entry->node != node)
+        return;
+
+    for(i = 0; i < entry->levels; i++)
+    {
+        prev = update[i];
+        while(prev->next[i] != entry)
+        {
+            prev = prev->next[i];
+        }
+        prev->next[i] = entry->next[i];
+    }
+    while(skip->levels > 1 && skip->head->next[skip->levels - 1] == NULL)
+    {
+        skip->levels--;
+    }
+    free(entry);
+}
+
+/* Throws the entries away and builds the index again over the (sorted) list
+ * in one pass.
+ */
+static void skip_rebuild(list_t *list_ptr)
+{
+    list_skip_t *skip = list_ptr->skip_index;
+    skip_entry_t *last[SKIP_MAX_LEVEL];
+    skip_entry_t *entry;
+    list_node_t *node;
+    int levels, i;
+
+    skip_clear(skip);
+    for(i = 0; i < SKIP_MAX_LEVEL; i++)
+    {
+        last[i] = skip->head;
+    }
+
+    for(node = list_ptr->head->next; node != list_ptr->tail; node = node->next)
+    {
+        levels = skip_random_levels(skip);
+        if(levels == 0)
+            continue;
+        entry = (skip_entry_t *) malloc(sizeof(skip_entry_t) +
+                levels * sizeof(skip_entry_t *));
+        assert(entry != NULL);
+        entry->node = node;
+        entry->levels = levels;
+        for(i = 0; i < levels; i++)
+        {
+            entry->next[i] = NULL;
+            last[i]->next[i] = entry;
+            last[i] = entry;
+        }
+        if(levels > skip->levels)
+            skip->levels = levels;
+    }
+    skip->valid = 1;
+}
+
+/* Frees every entry of the index, leaving it empty and invalid */
+static void skip_clear(list_skip_t *skip)
+{
+    skip_entry_t *entry, *next;
+    int i;
+
+    entry = skip->head->next[0];
+    while(entry != NULL)
+    {
+        next = entry->next[0];
+        free(entry);
+        entry = next;
+    }
+    for(i = 0; i < SKIP_MAX_LEVEL; i++)
+    {
+        skip->head->next[i] = NULL;
+    }
+    skip->levels = 1;
+    skip->valid = 0;
+}
+
+/* Draws the number of levels for a new entry: 0 (no entry) with probability
+ * 1 - 1/SKIP_FANOUT, and each further level with probability 1/SKIP_FANOUT.
+ */
+static int skip_random_levels(list_skip_t *skip)
+{
+    int levels = 0;
+
+    do
+    {
+        //xorshift32
+        skip->seed ^= skip->seed << 13;
+        skip->seed ^= skip->seed >> 17;
+        skip->seed ^= skip->seed << 5;
+        levels++;
+    }
+    while(levels < SKIP_MAX_LEVEL && skip->seed % SKIP_FANOUT == 0);
+    return levels - 1;
+}
+
+/* Returns the node at position index of the list, counting from 0 at the
+ * first node, or the dummy tail if index equals the size of the list.
+ *
+ * Positional calls build the order statistic index of the list on first use
+ * (see rank_node_t), after which they take O(log n) time, as do list_insert,
+ * list_insert_sorted and list_remove to keep the index up to date.  Bulk
+ * changes and sorts make the next positional call rebuild the index in O(n).
+ */
+list_node_t * list_at(list_t *list_ptr, size_t index)
+{
+    list_rank_t *rank;
+    rank_node_t *tree;
+    list_node_t *node;
+    size_t left;
+
+    assert(list_ptr != NULL && index <= (size_t) list_ptr->current_list_size);
+    if(index == (size_t) list_ptr->current_list_size)
+        return list_ptr->tail;
+    if(list_ptr->current_list_size <= RANK_WALK)
+    {
+        for(node = list_ptr->head->next; index > 0; index--)
+            node = node->next;
+        return node;
+    }
+
+    rank = rank_ready(list_ptr);
+    tree = rank->root;
+    for(;;)
+    {
+        left = tree->left != NULL ? tree->left->size : 0;
+        if(index < left)
+        {
+            tree = tree->left;
+        }
+        else if(index == left)
+        {
+            return tree->node;
+        }
+        else
+        {
+            index -= left + 1;
+            tree = tree->right;
+        }
+    }
+}
+
+/* Returns the position of the node idx_ptr in the list, counting from 0 at
+ * the first node.  The dummy tail is at the position equal to the size of
+ * the list.
+ */
+size_t list_index_of(list_t *list_ptr, list_node_t *idx_ptr)
+{
+    list_rank_t *rank;
+    rank_node_t *tree;
+    list_node_t *node;
+    size_t index = 0;
+
+    assert(list_ptr != NULL && idx_ptr != NULL && idx_ptr != list_ptr->head);
+    if(idx_ptr == list_ptr->tail)
+        return list_ptr->current_list_size;
+    if(list_ptr->current_list_size <= RANK_WALK)
+    {
+        for(node = list_ptr->head->next; node != idx_ptr; node = node->next)
+        {
+            assert(node != list_ptr->tail);
+            index++;
+        }
+        return index;
+    }
+
+    rank = rank_ready(list_ptr);
+    tree = rank_lookup(rank, idx_ptr);
+    assert(tree != NULL);
+    index = tree->left != NULL ? tree->left->size : 0;
+    for(; tree->parent != NULL; tree = tree->parent)
+    {
+        if(tree == tree->parent->right)
+            index += (tree->parent->left != NULL ? tree->parent->left->size : 0) + 1;
+    }
+    return index;
+}
+
+/* Sets *first and *last to the nodes at positions from and to, so that
+ * [*first, *last) is the range of elements from position from up to, not
+ * including, position to, as taken by list_splice and list_remove_range.
+ */
+void list_range(list_t *list_ptr, size_t from, size_t to, list_node_t **first,
+        list_node_t **last)
+{
+    size_t i;
+
+    assert(first != NULL && last != NULL && from <= to);
+    *first = list_at(list_ptr, from);
+    if(to - from <= RANK_WALK)
+    {
+        //Near enough to walk
+        for(*last = *first, i = from; i < to; i++)
+            *last = (*last)->next;
+    }
+    else
+    {
+        *last = list_at(list_ptr, to);
+    }
+}
+
+/* Returns the order statistic index of the list, building it if needed, and
+ * notes that it is in use.
+ */
+static list_rank_t *rank_ready(list_t *list_ptr)
+{
+    if(list_ptr->rank_index == NULL)
+        rank_build(list_ptr);
+    list_ptr->rank_index->idle = list_ptr->current_list_size + RANK_IDLE_MIN;
+    return list_ptr->rank_index;
+}
+
+/* Frees the order statistic index of the list, if it has one */
+static void rank_free(list_t *list_ptr)
+{
+    list_rank_t *rank = list_ptr->rank_index;
+    rank_chunk_t *chunk, *next;
+
+    if(rank == NULL)
+        return;
+    for(chunk = rank->chunks; chunk != NULL; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(rank->slots);
+    free(rank);
+    list_ptr->rank_index = NULL;
+}
+
+/* Builds the index over the whole list in one pass, as a Cartesian tree of
+ * random priorities over the nodes in list order: each new node goes on the
+ * right spine of the tree built so far.
+ */
+static void rank_build(list_t *list_ptr)
+{
+    list_rank_t *rank;
+    rank_node_t *tree, *spine = NULL, *below;
+    list_node_t *node;
+    size_t slots = 16;
+    int n = list_ptr->current_list_size;
+
+    rank = (list_rank_t *) calloc(1, sizeof(list_rank_t));
+    assert(rank != NULL);
+    rank->seed = 2463534242u;
+    list_ptr->rank_index = rank;
+    while(slots < (size_t) n * 2)
+        slots *= 2;
+    rank_hash_resize(rank, slots);
+
+    //One chunk for all nodes
+    rank->chunks = (rank_chunk_t *) malloc(sizeof(rank_chunk_t) +
+            (n > 0 ? n : 1) * sizeof(rank_node_t));
+    assert(rank->chunks != NULL);
+    rank->chunks->next = NULL;
+    rank->chunks->used = 0;
+    rank->chunks->count = n > 0 ? n : 1;
+
+    for(node = list_ptr->head->next; node != list_ptr->tail; node = node->next)
+    {
+        tree = rank_node_alloc(rank, node);
+        below = NULL;
+        while(spine != NULL && spine->priority < tree->priority)
+        {
+            below = spine;
+            spine = spine->parent;
+        }
+        tree->left = below;
+        if(below != NULL)
+            below->parent = tree;
+        tree->parent = spine;
+        if(spine != NULL)
+            spine->right = tree;
+        else
+            rank->root = tree;
+        spine = tree;
+        rank_hash_put(rank, tree);
+    }
+    rank_count(rank->root);
+}
+
+/* Counts an update of the list against its order statistic index.  Returns
+ * 1 if the index is to be kept up to date, 0 if it has been idle for so long
+ * that it was freed instead.
+ */
+static int rank_idle(list_t *list_ptr)
+{
+    list_rank_t *rank = list_ptr->rank_index;
+
+    if(--rank->idle < 0)
+    {
+        rank_free(list_ptr);
+        return 0;
+    }
+    return 1;
+}
+
+/* Gives a node just linked into the list a tree node, in front of the tree
+ * node of its successor, and rotates it up to its place in the heap order.
+ */
+static void rank_add(list_t *list_ptr, list_node_t *node)
+{
+    list_rank_t *rank = list_ptr->rank_index;
+    rank_node_t *tree, *next, *parent;
+
+    if(!rank_idle(list_ptr))
+        return;
+
+    tree = rank_node_alloc(rank, node);
+    tree->size = 1;
+    next = node->next == list_ptr->tail ? NULL : rank_lookup(rank, node->next);
+    assert(node->next == list_ptr->tail || next != NULL);
+
+    //The predecessor of next in the tree, if it has a left subtree, or the
+    //last tree node, gets the new node as its right child
+    if(next != NULL && next->left == NULL)
+    {
+        next->left = tree;
+        tree->parent = next;
+    }
+    else
+    {
+        parent = next != NULL ? next->left : rank->root;
+        while(parent != NULL && parent->right != NULL)
+            parent = parent->right;
+        tree->parent = parent;
+        if(parent != NULL)
+            parent->right = tree;
+        else
+            rank->root = tree;
+    }
+    for(parent = tree->parent; parent != NULL; parent = parent->parent)
+        parent->size++;
+
+    while(tree->parent != NULL && tree->parent->priority < tree->priority)
+        rank_rotate_up(rank, tree);
+    rank_hash_put(rank, tree);
+}
+
+/* Removes the tree node of a node that is about to be removed from the list:
+ * rotates it down until it has at most one child, which takes its place.
+ */
+static void rank_drop(list_t *list_ptr, list_node_t *node)
+{
+    list_rank_t *rank = list_ptr->rank_index;
+    rank_node_t *tree, *child, *parent;
+
+    if(!rank_idle(list_ptr))
+        return;
+
+    tree = rank_lookup(rank, node);
+    assert(tree != NULL);
+    while(tree->left != NULL && tree->right != NULL)
+    {
+        if(tree->left->priority > tree->right->priority)
+            rank_rotate_up(rank, tree->left);
+        else
+            rank_rotate_up(rank, tree->right);
+    }
+
+    child = tree->left != NULL ? tree->left : tree->right;
+    parent = tree->parent;
+    if(child != NULL)
+        child->parent = parent;
+    if(parent == NULL)
+        rank->root = child;
+    else if(parent->left == tree)
+        parent->left = child;
+    else
+        parent->right = child;
+    for(; parent != NULL; parent = parent->parent)
+        parent->size--;
+
+    rank_hash_delete(rank, node);
+    tree->right = rank->free_nodes;
+    rank->free_nodes = tree;
+    rank->count--;
+}
+
+/* Takes a tree node for node from the free list or the newest chunk and
+ * gives it a random priority.  The caller links it into the tree.
+ */
+static rank_node_t *rank_node_alloc(list_rank_t *rank, list_node_t *node)
+{
+    rank_node_t *tree;
+    rank_chunk_t *chunk;
+
+    if(rank->free_nodes != NULL)
+    {
+        tree = rank->free_nodes;
+        rank->free_nodes = tree->right;
+    }
+    else
+    {
+        if(rank->chunks == NULL || rank->chunks->used == rank->chunks->count)
+        {
+            chunk = (rank_chunk_t *) malloc(sizeof(rank_chunk_t) +
+                    RANK_CHUNK * sizeof(rank_node_t));
+            assert(chunk != NULL);
+            chunk->next = rank->chunks;
+            chunk->used = 0;
+            chunk->count = RANK_CHUNK;
+            rank->chunks = chunk;
+        }
+        tree = &rank->chunks->nodes[rank->chunks->used++];
+    }
+
+    //xorshift32
+    rank->seed ^= rank->seed << 13;
+    rank->seed ^= rank->seed >> 17;
+    rank->seed ^= rank->seed << 5;
+    tree->priority = rank->seed;
+    tree->node = node;
+    tree->parent = tree->left = tree->right = NULL;
+    rank->count++;
+    return tree;
+}
+
+/* Sets the size of every node in the tree, returning the size of the whole.
+ * The recursion is as deep as the treap, O(log n) expected.
+ */
+static int rank_count(rank_node_t *tree)
+{
+    if(tree == NULL)
+        return 0;
+    tree->size = 1 + rank_count(tree->left) + rank_count(tree->right);
+    return tree->size;
+}
+
+/* Rotates tree above its parent, keeping the list order and the sizes */
+static void rank_rotate_up(list_rank_t *rank, rank_node_t *tree)
+{
+    rank_node_t *parent = tree->parent, *grand = parent->parent;
+
+    if(tree == parent->left)
+    {
+        parent->left = tree->right;
+        if(tree->right != NULL)
+            tree->right->parent = parent;
+        tree->right = parent;
+    }
+    else
+    {
+        parent->right = tree->left;
+        if(tree->left != NULL)
+            tree->left->parent = parent;
+        tree->left = parent;
+    }
+    parent->parent = tree;
+    tree->parent = grand;
+    if(grand == NULL)
+        rank->root = tree;
+    else if(grand->left == parent)
+        grand->left = tree;
+    else
+        grand->right = tree;
+
+    tree->size = parent->size;
+    parent->size = 1 + (parent->left != NULL ? parent->left->size : 0) +
+        (parent->right != NULL ? parent->right->size : 0);
+}
+
+/* Returns the home slot of node in the hash table */
+static size_t rank_slot(list_rank_t *rank, list_node_t *node)
+{
+    //Fibonacci hashing of the address, whose low bits are all alike
+    return (size_t) (((unsigned long long) (size_t) node >> 4) *
+            11400714819323198485ull >> 17) & rank->slot_mask;
+}
+
+/* Returns the tree node of node, or NULL if it has none */
+static rank_node_t *rank_lookup(list_rank_t *rank, list_node_t *node)
+{
+    size_t i;
+
+    for(i = rank_slot(rank, node); rank->slots[i] != NULL;
+            i = (i + 1) & rank->slot_mask)
+    {
+        if(rank->slots[i]->node == node)
+            return rank->slots[i];
+    }
+    return NULL;
+}
+
+/* Enters a tree node into the hash table, growing the table to keep it at
+ * most half full.  rank->count already includes the new node.
+ */
+static void rank_hash_put(list_rank_t *rank, rank_node_t *tree)
+{
+    size_t i;
+
+    if((size_t) rank->count * 2 > rank->slot_mask + 1)
+        rank_hash_resize(rank, (rank->slot_mask + 1) * 2);
+    for(i = rank_slot(rank, tree->node); rank->slots[i] != NULL;
+            i = (i + 1) & rank->slot_mask)
+        ;
+    rank->slots[i] = tree;
+}
+
+/* Removes node from the hash table, moving later entries of its probe
+ * sequence back so that no lookup stops early at the emptied slot.
+ */
+static void rank_hash_delete(list_rank_t *rank, list_node_t *node)
+{
+    size_t i, j, home;
+
+    for(i = rank_slot(rank, node); rank->slots[i]->node != node;
+            i = (i + 1) & rank->slot_mask)
+        ;
+    for(j = (i + 1) & rank->slot_mask; rank->slots[j] != NULL;
+            j = (j + 1) & rank->slot_mask)
+    {
+        //An entry may move back to i unless its home lies in (i, j]
+        home = rank_slot(rank, rank->slots[j]->node);
+        if((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j))
+        {
+            rank->slots[i] = rank->slots[j];
+            i = j;
+        }
+    }
+    rank->slots[i] = NULL;
+}
+
+/* Replaces the hash table with an empty one of slots slots (a power of two)
+ * and enters the tree nodes of the old one.
+ */
+static void rank_hash_resize(list_rank_t *rank, size_t slots)
+{
+    rank_node_t **old = rank->slots;
+    size_t old_slots = old != NULL ? rank->slot_mask + 1 : 0, i, j;
+
+    rank->slots = (rank_node_t **) calloc(slots, sizeof(rank_node_t *));
+    assert(rank->slots != NULL);
+    rank->slot_mask = slots - 1;
+    for(i = 0; i < old_slots; i++)
+    {
+        if(old[i] == NULL)
+            continue;
+        for(j = rank_slot(rank, old[i]->node); rank->slots[j] != NULL;
+                j = (j + 1) & rank->slot_mask)
+            ;
+        rank->slots[j] = old[i];
+    }
+    free(old);
+}
+
+/* Fills the hash index with all nodes of the list, in list order so that
+ * the first node of each group is the first one entered.
+ */
+static void hash_build(list_t *list_ptr)
+{
+    list_hash_t *hash = list_ptr->hash_index;
+    list_node_t *node;
+    size_t slots = HASH_MIN_SLOTS;
+
+    while(slots < (size_t) list_ptr->current_list_size * 2)
+        slots *= 2;
+    free(hash->slots);
+    free(hash->hashes);
+    free(hash->sizes);
+    free(hash->members);
+    hash->slots = NULL;
+    hash->hashes = NULL;
+    hash->sizes = NULL;
+    hash->members = NULL;
+    hash->count = 0;
+    hash->member_count = 0;
+    hash_resize(hash, slots);
+    for(node = list_ptr->head->next; node != list_ptr->tail; node = node->next)
+        hash_put(list_ptr, node, hash->hash_proc(node->data_ptr));
+    hash->valid = 1;
+}
+
+/* Enters a node just linked into the list, if the index is up to date.  If
+ * the node joins a group it is linked in after the group's node that comes
+ * before it in the list, which is an equal neighbour where there is one,
+ * the group's last node if it was appended, and otherwise the nearest equal
+ * node walking back from it; if there is none it becomes the first.
+ */
+static void hash_add(list_t *list_ptr, list_node_t *node)
+{
+    list_hash_t *hash = list_ptr->hash_index;
+    list_node_t *first, *prev;
+    unsigned long key;
+    size_t i;
+
+    if(!hash->valid)
+        return;
+    key = hash->hash_proc(node->data_ptr);
+    i = hash_group(list_ptr, node->data_ptr, key);
+    if(hash->slots[i] == NULL)
+    {
+        hash_put(list_ptr, node, key);
+        return;
+    }
+
+    first = hash->slots[i];
+    hash->sizes[i]++;
+    if(node->next == list_ptr->tail)
+        prev = hash_prev(hash, first);
+    else if(node->next == first || node->prev == list_ptr->head)
+        prev = list_ptr->head;
+    //list_insert_sorted puts a node after its equals
+    else if(COMPARE(list_ptr->comp_proc, node->data_ptr, node->prev->data_ptr) == 0)
+        prev = node->prev;
+    else if(COMPARE(list_ptr->comp_proc, node->data_ptr, node->next->data_ptr) == 0)
+        prev = hash_prev(hash, node->next);
+    else
+    {
+        for(prev = node->prev->prev; prev != list_ptr->head; prev = prev->prev)
+        {
+            STATS_ADD(list_ptr, nodes_traversed, 1);
+            if(COMPARE(list_ptr->comp_proc, node->data_ptr, prev->data_ptr) == 0)
+                break;
+        }
+    }
+
+    if(prev != list_ptr->head)
+    {
+        hash_link(hash, node, prev);
+        return;
+    }
+    hash_link(hash, node, hash_prev(hash, first));
+    hash->slots[i] = node;
+}
+
+/* Takes a node that is about to be removed from the list out of its group.
+ * If it was the first node of the group, the group's next node takes its
+ * place.
+ */
+static void hash_drop(list_t *list_ptr, list_node_t *node)
+{
+    list_hash_t *hash = list_ptr->hash_index;
+    size_t i;
+
+    if(!hash->valid)
+        return;
+    i = hash_group(list_ptr, node->data_ptr, hash->hash_proc(node->data_ptr));
+    assert(hash->slots[i] != NULL);
+    if(--hash->sizes[i] == 0)
+    {
+        hash_delete(hash, i);
+        return;
+    }
+    if(hash->slots[i] == node)
+        hash->slots[i] = hash_next(hash, node);
+    hash_unlink(hash, node);
+}
+
+/* Returns the first node in list order whose element the comparison
+ * function ranks equal to elem_ptr, or the dummy tail if there is none.
+ */
+static list_node_t *hash_find(list_t *list_ptr, void *elem_ptr)
+{
+    list_hash_t *hash = list_ptr->hash_index;
+    size_t i;
+
+    if(!hash->valid)
+        hash_build(list_ptr);
+    i = hash_group(list_ptr, elem_ptr, hash->hash_proc(elem_ptr));
+    return hash->slots[i] != NULL ? hash->slots[i] : list_ptr->tail;
+}
+
+/* Returns the slot of the group of elem_ptr, whose hash is key, or the free
+ * slot that ends its probe sequence if there is no such group.
+ */
+static size_t hash_group(list_t *list_ptr, void *elem_ptr, unsigned long key)
+{
+    list_hash_t *hash = list_ptr->hash_index;
+    size_t i;
+
+    for(i = hash_slot(hash, key); hash->slots[i] != NULL;
+            i = (i + 1) & hash->slot_mask)
+    {
+        STATS_ADD(list_ptr, nodes_traversed, 1);
+        if(hash->hashes[i] == key &&
+                COMPARE(list_ptr->comp_proc, elem_ptr, hash->slots[i]->data_ptr) == 0)
+            break;
+    }
+    return i;
+}
+
+/* Returns the home slot of a hash in the table.  The user's hash is mixed
+ * once more, since the table only uses its low bits.
+ */
+static size_t hash_slot(list_hash_t *hash, unsigned long key)
+{
+    return (size_t) ((unsigned long long) key * 11400714819323198485ull >> 24) &
+        hash->slot_mask;
+}
+
+/* Enters node, whose element hashes to key, as the first node of its group
+ * or, if the group exists, as its last node.  The table grows to stay at
+ * most half full.
+ */
+static void hash_put(list_t *list_ptr, list_node_t *node, unsigned long key)
+{
+    list_hash_t *hash = list_ptr->hash_index;
+    size_t i;
+
+    if((size_t) (hash->count + 1) * 2 > hash->slot_mask + 1)
+        hash_resize(hash, (hash->slot_mask + 1) * 2);
+    i = hash_group(list_ptr, node->data_ptr, key);
+    if(hash->slots[i] != NULL)
+    {
+        hash->sizes[i]++;
+        hash_link(hash, node, hash_prev(hash, hash->slots[i]));
+        return;
+    }
+    hash->slots[i] = node;
+    hash->hashes[i] = key;
+    hash->sizes[i] = 1;
+    hash->count++;
+}
+
+/* Frees slot i, moving later entries of its probe sequence back so that no
+ * lookup stops early at the emptied slot.
+ */
+static void hash_delete(list_hash_t *hash, size_t i)
+{
+    size_t j, home;
+
+    for(j = (i + 1) & hash->slot_mask; hash->slots[j] != NULL;
+            j = (j + 1) & hash->slot_mask)
+    {
+        //An entry may move back to i unless its home lies in (i, j]
+        home = hash_slot(hash, hash->hashes[j]);
+        if((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j))
+        {
+            hash->slots[i] = hash->slots[j];
+            hash->hashes[i] = hash->hashes[j];
+            hash->sizes[i] = hash->sizes[j];
+            i = j;
+        }
+    }
+    hash->slots[i] = NULL;
+    hash->count--;
+}
+
+/* Replaces the table with an empty one of slots slots (a power of two) and
+ * enters the groups of the old one.
+ */
+static void hash_resize(list_hash_t *hash, size_t slots)
+{
+    list_node_t **old = hash->slots;
+    unsigned long *old_hashes = hash->hashes;
+    int *old_sizes = hash->sizes;
+    size_t old_slots = old != NULL ? hash->slot_mask + 1 : 0, i, j;
+
+    hash->slots = (list_node_t **) calloc(slots, sizeof(list_node_t *));
+    hash->hashes = (unsigned long *) malloc(slots * sizeof(unsigned long));
+    hash->sizes = (int *) malloc(slots * sizeof(int));
+    assert(hash->slots != NULL && hash->hashes != NULL && hash->sizes != NULL);
+    hash->slot_mask = slots - 1;
+    for(i = 0; i < old_slots; i++)
+    {
+        if(old[i] == NULL)
+            continue;
+        for(j = hash_slot(hash, old_hashes[i]); hash->slots[j] != NULL;
+                j = (j + 1) & hash->slot_mask)
+            ;
+        hash->slots[j] = old[i];
+        hash->hashes[j] = old_hashes[i];
+        hash->sizes[j] = old_sizes[i];
+    }
+    free(old);
+    free(old_hashes);
+    free(old_sizes);
+}
+
+/* The nodes after and before node in its group, going round from the last
+ * to the first.  A node alone in its group has no entry and is its own
+ * neighbour.
+ */
+static list_node_t *hash_next(list_hash_t *hash, list_node_t *node)
+{
+    hash_member_t *member = hash_member(hash, node);
+
+    return member != NULL ? member->next : node;
+}
+
+static list_node_t *hash_prev(list_hash_t *hash, list_node_t *node)
+{
+    hash_member_t *member = hash_member(hash, node);
+
+    return member != NULL ? member->prev : node;
+}
+
+/* Links node into the group of after, just after it */
+static void hash_link(list_hash_t *hash, list_node_t *node, list_node_t *after)
+{
+    list_node_t *next = hash_next(hash, after);
+
+    hash_member_set(hash, node, after, next);
+    if(next == after)
+    {
+        hash_member_set(hash, after, node, node);
+        return;
+    }
+    hash_member_set(hash, after, hash_prev(hash, after), node);
+    hash_member_set(hash, next, node, hash_next(hash, next));
+}
+
+/* Unlinks node from its group, dropping the entry of a node left alone */
+static void hash_unlink(list_hash_t *hash, list_node_t *node)
+{
+    list_node_t *prev = hash_prev(hash, node), *next = hash_next(hash, node);
+
+    if(prev == node)
+        return;
+    hash_member_delete(hash, node);
+    if(prev == next)
+    {
+        hash_member_delete(hash, prev);
+        return;
+    }
+    hash_member_set(hash, prev, hash_prev(hash, prev), next);
+    hash_member_set(hash, next, prev, hash_next(hash, next));
+}
+
+/* Returns the home slot of node in the member table */
+static size_t hash_member_slot(list_hash_t *hash, list_node_t *node)
+{
+    //Fibonacci hashing of the address, as for the order index
+    return (size_t) (((unsigned long long) (size_t) node >> 4) *
+            11400714819323198485ull >> 17) & hash->member_mask;
+}
+
+/* Returns the member entry of node, or NULL if it has none */
+static hash_member_t *hash_member(list_hash_t *hash, list_node_t *node)
+{
+    size_t i;
+
+    if(hash->members == NULL)
+        return NULL;
+    for(i = hash_member_slot(hash, node); hash->members[i].node != NULL;
+            i = (i + 1) & hash->member_mask)
+    {
+        if(hash->members[i].node == node)
+            return &hash->members[i];
+    }
+    return NULL;
+}
+
+/* Sets the neighbours of node within its group, entering it in the member
+ * table if it is not there.  The table grows to stay at most half full.
+ */
+static void hash_member_set(list_hash_t *hash, list_node_t *node,
+        list_node_t *prev, list_node_t *next)
+{
+    hash_member_t *member = hash_member(hash, node);
+    size_t i;
+
+    if(member == NULL)
+    {
+        if(hash->members == NULL)
+            hash_member_resize(hash, HASH_MIN_SLOTS);
+        else if((size_t) (hash->member_count + 1) * 2 > hash->member_mask + 1)
+            hash_member_resize(hash, (hash->member_mask + 1) * 2);
+        for(i = hash_member_slot(hash, node); hash->members[i].node != NULL;
+                i = (i + 1) & hash->member_mask)
+            ;
+        member = &hash->members[i];
+        member->node = node;
+        hash->member_count++;
+    }
+    member->prev = prev;
+    member->next = next;
+}
+
+/* Removes node from the member table, moving later entries of its probe
+ * sequence back so that no lookup stops early at the emptied slot.
+ */
+static void hash_member_delete(list_hash_t *hash, list_node_t *node)
+{
+    size_t i, j, home;
+
+    for(i = hash_member_slot(hash, node); hash->members[i].node != node;
+            i = (i + 1) & hash->member_mask)
+        ;
+    for(j = (i + 1) & hash->member_mask; hash->members[j].node != NULL;
+            j = (j + 1) & hash->member_mask)
+    {
+        //An entry may move back to i unless its home lies in (i, j]
+        home = hash_member_slot(hash, hash->members[j].node);
+        if((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j))
+        {
+            hash->members[i] = hash->members[j];
+            i = j;
+        }
+    }
+    hash->members[i].node = NULL;
+    hash->member_count--;
+}
+
+/* Replaces the member table with an empty one of slots slots (a power of
+ * two) and enters the entries of the old one.
+ */
+static void hash_member_resize(list_hash_t *hash, size_t slots)
+{
+    hash_member_t *old = hash->members;
+    size_t old_slots = old != NULL ? hash->member_mask + 1 : 0, i, j;
+
+    hash->members = (hash_member_t *) calloc(slots, sizeof(hash_member_t));
+    assert(hash->members != NULL);
+    hash->member_mask = slots - 1;
+    for(i = 0; i < old_slots; i++)
+    {
+        if(old[i].node == NULL)
+            continue;
+        for(j = hash_member_slot(hash, old[i].node); hash->members[j].node != NULL;
+                j = (j + 1) & hash->member_mask)
+            ;
+        hash->members[j] = old[i];
+    }
+    free(old);
+}
+
+/* Returns the first element of the list, in list order, whose key in the key
+ * column is at least lo and at most hi, or NULL if there is none.  The keys
+ * are compared as the kind given to set_key_column says.
+ */
+list_node_t * list_key_find(list_t *list_ptr, list_key_t lo, list_key_t hi)
+{
+    list_keys_t *keys;
+    int i;
+
+    assert(list_ptr != NULL && list_ptr->key_column != NULL);
+    keys = keys_ready(list_ptr);
+    i = keys_scan(keys, keys_map(keys, lo), keys_map(keys, hi), NULL);
+    return i < keys->count ? keys->nodes[keys->start + i] : NULL;
+}
+
+/* Returns the number of elements of the list whose key in the key column is
+ * at least lo and at most hi.
+ */
+int list_key_count(list_t *list_ptr, list_key_t lo, list_key_t hi)
+{
+    list_keys_t *keys;
+    int count;
+
+    assert(list_ptr != NULL && list_ptr->key_column != NULL);
+    keys = keys_ready(list_ptr);
+    keys_scan(keys, keys_map(keys, lo), keys_map(keys, hi), &count);
+    return count;
+}
+
+/* Returns the key column of the list, rebuilt from the elements if it is
+ * stale.
+ */
+static list_keys_t *keys_ready(list_t *list_ptr)
+{
+    list_keys_t *keys = list_ptr->key_column;
+    list_node_t *node;
+
+    if(keys->valid)
+        return keys;
+
+    keys->start = 0;
+    keys->count = 0;
+    if(keys->slots < list_ptr->current_list_size)
+        keys_resize(keys, list_ptr->current_list_size);
+    for(node = list_ptr->head->next; node != list_ptr->tail; node = node->next)
+        keys_put(keys, keys->count++, node);
+    keys->valid = 1;
+    return keys;
+}
+
+/* Keeps the key column up to date after node was linked into the list.
+ * Only appends at the back are entered, anything else makes it stale.
+ */
+static void keys_add(list_t *list_ptr, list_node_t *node)
+{
+    list_keys_t *keys = list_ptr->key_column;
+
+    if(!keys->valid)
+        return;
+    if(node->next != list_ptr->tail)
+    {
+        keys->valid = 0;
+        return;
+    }
+    if(keys->start + keys->count == keys->slots)
+    {
+        if(keys->start > keys->count)
+        {
+            //Most of the column is removed entries from the front
+            memmove(keys->nodes, keys->nodes + keys->start,
+                    keys->count * sizeof(list_node_t *));
+            memmove(keys->keys, (char *) keys->keys + keys->start * keys->width,
+                    keys->count * keys->width);
+            keys->start = 0;
+        }
+        else
+        {
+            keys_resize(keys, 2 * keys->slots > KEYS_MIN_SLOTS ?
+                    2 * keys->slots : KEYS_MIN_SLOTS);
+        }
+    }
+    keys_put(keys, keys->start + keys->count++, node);
+}
+
+/* Keeps the key column up to date before node is unlinked from the list.
+ * Only removes at the front or the back are entered, anything else makes it
+ * stale.
+ */
+static void keys_drop(list_t *list_ptr, list_node_t *node)
+{
+    list_keys_t *keys = list_ptr->key_column;
+
+    if(!keys->valid)
+        return;
+    if(node->prev == list_ptr->head)
+    {
+        keys->start++;
+        keys->count--;
+    }
+    else if(node->next == list_ptr->tail)
+    {
+        keys->count--;
+    }
+    else
+    {
+        keys->valid = 0;
+    }
+}
+
+/* Stores the key of the element of node, and node, at position i of the
+ * column.
+ */
+static void keys_put(list_keys_t *keys, int i, list_node_t *node)
+{
+    long long key = keys_map(keys, keys->key_proc(node->data_ptr));
+
+    if(keys->width == sizeof(int32_t))
+        ((int32_t *) keys->keys)[i] = (int32_t) key;
+    else
+        ((int64_t *) keys->keys)[i] = key;
+    keys->nodes[i] = node;
+}
+
+/* Maps a key to the signed integer that the column keeps for it, which
+ * orders like the key does.
+ */
+static long long keys_map(list_keys_t *keys, list_key_t key)
+{
+    switch(keys->kind)
+    {
+    case LIST_KEY_INT32:
+        return key.i32;
+    case LIST_KEY_INT64:
+        return key.i64;
+    default:
+        return (long long) (key.u64 ^ (1ULL << 63));
+    }
+}
+
+static void keys_resize(list_keys_t *keys, int slots)
+{
+    keys->keys = realloc(keys->keys, (size_t) slots * keys->width);
+    keys->nodes = (list_node_t **) realloc(keys->nodes,
+            (size_t) slots * sizeof(list_node_t *));
+    assert(keys->keys != NULL && keys->nodes != NULL);
+    keys->slots = slots;
+}
+
+/* Scans the column for keys from lo to hi.  With count NULL returns the
+ * position of the first, or keys->count if there is none; otherwise stores
+ * how many there are in *count.  Uses AVX2 or SSE where the processor has
+ * them.
+ */
+static int keys_scan(list_keys_t *keys, long long lo, long long hi, int *count)
+{
+    const void *column = (char *) keys->keys + keys->start * keys->width;
+
+    if(count != NULL)
+        *count = 0;
+    if(keys->width == sizeof(int32_t))
+    {
+#ifdef KEYS_X86
+        if(__builtin_cpu_supports("avx2"))
+            return keys_scan32_avx2((const int32_t *) column, keys->count,
+                    (int32_t) lo, (int32_t) hi, count);
+        if(__builtin_cpu_supports("sse2"))
+            return keys_scan32_sse2((const int32_t *) column, keys->count,
+                    (int32_t) lo, (int32_t) hi, count);
+#endif
+        return keys_scan32((const int32_t *) column, 0, keys->count,
+                (int32_t) lo, (int32_t) hi, count);
+    }
+#ifdef KEYS_X86
+    if(__builtin_cpu_supports("avx2"))
+        return keys_scan64_avx2((const int64_t *) column, keys->count, lo, hi,
+                count);
+    if(__builtin_cpu_supports("sse4.2"))
+        return keys_scan64_sse42((const int64_t *) column, keys->count, lo, hi,
+                count);
+#endif
+    return keys_scan64((const int64_t *) column, 0, keys->count, lo, hi, count);
+}
+
+/* The scans without vectors, over positions from to n - 1, adding what they
+ * count to *count.  The vector scans finish with them.
+ */
+static int keys_scan32(const int32_t *column, int from, int n, int32_t lo,
+        int32_t hi, int *count)
+{
+    int i, found = 0;
+
+    for(i = from; i < n; i++)
+    {
+        if(column[i] >= lo && column[i] <= hi)
+        {
+            if(count == NULL)
+                return i;
+            found++;
+        }
+    }
+    if(count != NULL)
+        *count += found;
+    return n;
+}
+
+static int keys_scan64(const int64_t *column, int from, int n, int64_t lo,
+        int64_t hi, int *count)
+{
+    int i, found = 0;
+
+    for(i = from; i < n; i++)
+    {
+        if(column[i] >= lo && column[i] <= hi)
+        {
+            if(count == NULL)
+                return i;
+            found++;
+        }
+    }
+    if(count != NULL)
+        *count += found;
+    return n;
+}
+
+#ifdef KEYS_X86
+/* The vector scans compare a vector of keys at a time, a key being outside
+ * the range if lo > key or key > hi.  Counting subtracts the all ones lanes
+ * of keys outside it from a vector of counters.
+ */
+__attribute__((target("avx2")))
+static int keys_scan32_avx2(const int32_t *column, int n, int32_t lo,
+        int32_t hi, int *count)
+{
+    __m256i vlo = _mm256_set1_epi32(lo), vhi = _mm256_set1_epi32(hi);
+    __m256i out, outside = _mm256_setzero_si256();
+    int32_t lanes[8];
+    int i, mask;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        out = _mm256_loadu_si256((const __m256i *) (column + i));
+        out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, out),
+                _mm256_cmpgt_epi32(out, vhi));
+        if(count != NULL)
+        {
+            outside = _mm256_sub_epi32(outside, out);
+            continue;
+        }
+        mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    if(count != NULL)
+    {
+        _mm256_storeu_si256((__m256i *) lanes, outside);
+        *count = i - (lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+                lanes[4] + lanes[5] + lanes[6] + lanes[7]);
+    }
+    return keys_scan32(column, i, n, lo, hi, count);
+}
+
+__attribute__((target("sse2")))
+static int keys_scan32_sse2(const int32_t *column, int n, int32_t lo,
+        int32_t hi, int *count)
+{
+    __m128i vlo = _mm_set1_epi32(lo), vhi = _mm_set1_epi32(hi);
+    __m128i out, outside = _mm_setzero_si128();
+    int32_t lanes[4];
+    int i, mask;
+
+    for(i = 0; i + 4 <= n; i += 4)
+    {
+        out = _mm_loadu_si128((const __m128i *) (column + i));
+        out = _mm_or_si128(_mm_cmpgt_epi32(vlo, out), _mm_cmpgt_epi32(out, vhi));
+        if(count != NULL)
+        {
+            outside = _mm_sub_epi32(outside, out);
+            continue;
+        }
+        mask = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    if(count != NULL)
+    {
+        _mm_storeu_si128((__m128i *) lanes, outside);
+        *count = i - (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+    return keys_scan32(column, i, n, lo, hi, count);
+}
+
+__attribute__((target("avx2")))
+static int keys_scan64_avx2(const int64_t *column, int n, int64_t lo,
+        int64_t hi, int *count)
+{
+    __m256i vlo = _mm256_set1_epi64x(lo), vhi = _mm256_set1_epi64x(hi);
+    __m256i out, outside = _mm256_setzero_si256();
+    int64_t lanes[4];
+    int i, mask;
+
+    for(i = 0; i + 4 <= n; i += 4)
+    {
+        out = _mm256_loadu_si256((const __m256i *) (column + i));
+        out = _mm256_or_si256(_mm256_cmpgt_epi64(vlo, out),
+                _mm256_cmpgt_epi64(out, vhi));
+        if(count != NULL)
+        {
+            outside = _mm256_sub_epi64(outside, out);
+            continue;
+        }
+        mask = ~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xf;
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    if(count != NULL)
+    {
+        _mm256_storeu_si256((__m256i *) lanes, outside);
+        *count = i - (int) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+    return keys_scan64(column, i, n, lo, hi, count);
+}
+
+__attribute__((target("sse4.2")))
+static int keys_scan64_sse42(const int64_t *column, int n, int64_t lo,
+        int64_t hi, int *count)
+{
+    __m128i vlo = _mm_set1_epi64x(lo), vhi = _mm_set1_epi64x(hi);
+    __m128i out, outside = _mm_setzero_si128();
+    int64_t lanes[2];
+    int i, mask;
+
+    for(i = 0; i + 2 <= n; i += 2)
+    {
+        out = _mm_loadu_si128((const __m128i *) (column + i));
+        out = _mm_or_si128(_mm_cmpgt_epi64(vlo, out), _mm_cmpgt_epi64(out, vhi));
+        if(count != NULL)
+        {
+            outside = _mm_sub_epi64(outside, out);
+            continue;
+        }
+        mask = ~_mm_movemask_pd(_mm_castsi128_pd(out)) & 0x3;
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    if(count != NULL)
+    {
+        _mm_storeu_si128((__m128i *) lanes, outside);
+        *count = i - (int) (lanes[0] + lanes[1]);
+    }
+    return keys_scan64(column, i, n, lo, hi, count);
+}
+#endif
+
+/* Obtains the length of the specified list, that is, the number of elements
+ * that the list contains. 
+ *
+ * list_ptr: pointer to list-of-interest.  
+ *
+ * Returns an integer equal to the number of elements stored in the list.  An
+ * empty list has a size of zero.
+ */
+int list_size(list_t *list_ptr)
+{
+    assert(list_ptr != NULL);
+    assert(list_ptr->current_list_size >= 0);
+    return list_ptr->current_list_size;
+}
+
+
+/* Copies the performance counters of the list into *stats.
+ *
+ * Returns 1 if the library keeps counters (it was built with LIST_STATS),
+ * and 0 after filling *stats with zeros otherwise.
+ */
+int list_stats(list_t *list_ptr, list_stats_t *stats)
+{
+    assert(list_ptr != NULL && stats != NULL);
+#ifdef LIST_STATS
+    *stats = list_ptr->stats;
+    return 1;
+#else
+    memset(stats, 0, sizeof(list_stats_t));
+    return 0;
+#endif
+}
+
+/* Sets all performance counters of the list back to zero */
+void list_stats_reset(list_t *list_ptr)
+{
+    assert(list_ptr != NULL);
+#ifdef LIST_STATS
+    memset(&list_ptr->stats, 0, sizeof(list_stats_t));
+#endif
+}
+
+/* Allocates a new, empty priority queue.  Like a List it needs a comparison
+ * function, set with pq_set_comp, before elements are pushed.
+ */
+list_pq_t * pq_construct(void)
+{
+    list_pq_t *pq = (list_pq_t *) calloc(1, sizeof(list_pq_t));
+
+    assert(pq != NULL);
+    return pq;
+}
+
+/* Sets the comparison function of the queue, with the convention of
+ * set_comp.  Only allowed while the queue is empty.
+ */
+void pq_set_comp(list_pq_t *pq, comparer comp_proc)
+{
+    assert(pq != NULL && pq->size == 0);
+    pq->comp_proc = comp_proc;
+}
+
+/* Frees the queue and the elements still in it, like list_destruct */
+void pq_destruct(list_pq_t *pq)
+{
+    list_pq_node_t *node, *next;
+
+    assert(pq != NULL);
+    pq_free_tree(pq->root);
+    for(node = pq->free_nodes; node != NULL; node = next)
+    {
+        next = node->sibling;
+        free(node);
+    }
+    free(pq);
+}
+
+/* Adds elem_ptr to the queue and returns a handle to it for
+ * pq_decrease_key.  The handle is valid until the element is popped.
+ */
+list_pq_node_t * pq_push(list_pq_t *pq, void *elem_ptr)
+{
+    list_pq_node_t *node;
+
+    assert(pq != NULL && pq->comp_proc != NULL && elem_ptr != NULL);
+    node = pq->free_nodes;
+    if(node != NULL)
+        pq->free_nodes = node->sibling;
+    else
+        node = (list_pq_node_t *) malloc(sizeof(list_pq_node_t));
+    assert(node != NULL);
+    node->data_ptr = elem_ptr;
+    node->seq = pq->next_seq++;
+    node->child = node->sibling = node->prev = NULL;
+
+    pq->root = pq->root == NULL ? node : pq_meld(pq, pq->root, node);
+    pq->size++;
+    return node;
+}
+
+/* Returns the element that pq_pop would remove, or NULL if the queue is
+ * empty.
+ */
+void * pq_peek(list_pq_t *pq)
+{
+    assert(pq != NULL);
+    return pq->root != NULL ? pq->root->data_ptr : NULL;
+}
+
+/* Removes and returns the element that goes first in the order of the
+ * comparison function, or returns NULL if the queue is empty.  Of elements
+ * of equal rank the one pushed first is popped first, the same order that
+ * list_insert_sorted gives a list.
+ */
+void * pq_pop(list_pq_t *pq)
+{
+    list_pq_node_t *root;
+
+    assert(pq != NULL);
+    root = pq->root;
+    if(root == NULL)
+        return NULL;
+    pq->root = pq_merge_pairs(pq, root->child);
+    pq->size--;
+    root->sibling = pq->free_nodes;
+    pq->free_nodes = root;
+    return root->data_ptr;
+}
+
+/* Restores the order of the queue after the element of handle was changed
+ * so that it ranks earlier (or the same).  It keeps its place among elements
+ * of equal rank by push order.  Changes that make it rank later are not
+ * allowed.
+ */
+void pq_decrease_key(list_pq_t *pq, list_pq_node_t *handle)
+{
+    assert(pq != NULL && handle != NULL);
+    if(handle == pq->root)
+        return;
+
+    //Cut the subtree of handle out and meld it back in at the root
+    if(handle->prev->child == handle)
+        handle->prev->child = handle->sibling;
+    else
+        handle->prev->sibling = handle->sibling;
+    if(handle->sibling != NULL)
+        handle->sibling->prev = handle->prev;
+    handle->sibling = handle->prev = NULL;
+    pq->root = pq_meld(pq, pq->root, handle);
+}
+
+/* Returns the number of elements in the queue */
+int pq_size(list_pq_t *pq)
+{
+    assert(pq != NULL);
+    return pq->size;
+}
+
+/* Returns 1 if node a goes before node b: it ranks earlier, or equal and
+ * was pushed first.
+ */
+static int pq_precedes(list_pq_t *pq, list_pq_node_t *a, list_pq_node_t *b)
+{
+    int c = COMPARE(pq->comp_proc, a->data_ptr, b->data_ptr);
+
+    return c == 1 || (c == 0 && a->seq < b->seq);
+}
+
+/* Melds the trees of roots a and b, whose sibling and prev links are
+ * ignored, making the later root the first child of the other.  Returns the
+ * new root, with cleared sibling and prev links.
+ */
+static list_pq_node_t *pq_meld(list_pq_t *pq, list_pq_node_t *a,
+        list_pq_node_t *b)
+{
+    list_pq_node_t *swap;
+
+    if(!pq_precedes(pq, a, b))
+    {
+        swap = a;
+        a = b;
+        b = swap;
+    }
+    b->prev = a;
+    b->sibling = a->child;
+    if(a->child != NULL)
+        a->child->prev = b;
+    a->child = b;
+    a->sibling = a->prev = NULL;
+    return a;
+}
+
+/* Melds the sibling list starting at first into one tree with the two pass
+ * pairing: neighbours are melded pairwise left to right, and the pairs then
+ * right to left.  Returns the root, or NULL if first is NULL.
+ */
+static list_pq_node_t *pq_merge_pairs(list_pq_t *pq, list_pq_node_t *first)
+{
+    list_pq_node_t *pairs = NULL, *tree, *next;
+
+    while(first != NULL)
+    {
+        tree = first;
+        next = first->sibling;
+        if(next != NULL)
+        {
+            first = next->sibling;
+            tree = pq_meld(pq, tree, next);
+        }
+        else
+        {
+            first = NULL;
+        }
+        //Stack the pairs through sibling, the last pair on top
+        tree->sibling = pairs;
+        pairs = tree;
+    }
+
+    tree = pairs;
+    if(tree != NULL)
+    {
+        pairs = tree->sibling;
+        while(pairs != NULL)
+        {
+            next = pairs->sibling;
+            tree = pq_meld(pq, pairs, tree);
+            pairs = next;
+        }
+        tree->sibling = tree->prev = NULL;
+    }
+    return tree;
+}
+
+/* Frees the nodes and elements of a tree.  Trees can be as deep as they are
+ * large, so the children of each node are spliced into the sibling list in
+ * front of its next sibling rather than recursed into.
+ */
+static void pq_free_tree(list_pq_node_t *node)
+{
+    list_pq_node_t *last, *next;
+
+    for(; node != NULL; node = next)
+    {
+        if(node->child != NULL)
+        {
+            for(last = node->child; last->sibling != NULL; last = last->sibling)
+                ;
+            last->sibling = node->sibling;
+            node->sibling = node->child;
+        }
+        next = node->sibling;
+        free(node->data_ptr);
+        free(node);
+    }
+}
+
+/* Allocates a new, empty concurrent queue, see list_queue_push */
+list_queue_t * list_queue_construct(void)
+{
+    list_queue_t *queue_ptr;
+    queue_node_t *dummy;
+
+    queue_ptr = (list_queue_t *) aligned_alloc(QUEUE_LINE, sizeof(list_queue_t));
+    dummy = (queue_node_t *) malloc(sizeof(queue_node_t));
+    assert(queue_ptr != NULL && dummy != NULL);
+    dummy->next = NULL;
+    dummy->data_ptr = NULL;
+    queue_ptr->head = dummy;
+    queue_ptr->tail = dummy;
+    return queue_ptr;
+}
+
+/* Frees the queue and the elements still in it, like list_destruct.  No other
+ * thread may be using the queue.  Nodes that were popped from it are freed
+ * by the threads that popped them, once no thread can still be reading them.
+ */
+void list_queue_destruct(list_queue_t *queue_ptr)
+{
+    queue_node_t *node, *next;
+
+    assert(queue_ptr != NULL);
+    for(node = queue_ptr->head->next; node != NULL; node = node->next)
+    {
+        free(node->data_ptr);
+    }
+    for(node = queue_ptr->head; node != NULL; node = next)
+    {
+        next = node->next;
+        free(node);
+    }
+    free(queue_ptr);
+    if(thread_hazards != NULL)
+        hazard_scan(thread_hazards);
+}
+
+/* Appends elem_ptr to the queue.  Safe to call from any number of threads at
+ * once, together with list_queue_pop.
+ */
+void list_queue_push(list_queue_t *queue_ptr, void *elem_ptr)
+{
+    hazard_rec_t *rec = hazard_acquire();
+    queue_node_t *node, *tail, *next;
+
+    assert(queue_ptr != NULL && elem_ptr != NULL);
+    node = (queue_node_t *) malloc(sizeof(queue_node_t));
+    assert(node != NULL);
+    node->next = NULL;
+    node->data_ptr = elem_ptr;
+
+    for(;;)
+    {
+        tail = hazard_protect(&rec->hazards[0], (void **) &queue_ptr->tail);
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if(next != NULL)
+        {
+            //The last push has not swung tail yet, finish it for them
+            __atomic_compare_exchange_n(&queue_ptr->tail, &tail, next, 0,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(__atomic_compare_exchange_n(&tail->next, &next, node, 0,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            break;
+    }
+    __atomic_compare_exchange_n(&queue_ptr->tail, &tail, node, 0,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->hazards[0], NULL, __ATOMIC_RELEASE);
+}
+
+/* Removes the element at the front of the queue and returns it, or returns
+ * NULL if the queue is empty.  Safe to call from any number of threads at
+ * once, together with list_queue_push.
+ */
+void * list_queue_pop(list_queue_t *queue_ptr)
+{
+    hazard_rec_t *rec = hazard_acquire();
+    queue_node_t *head, *tail, *next;
+    void *elem_ptr;
+
+    assert(queue_ptr != NULL);
+    for(;;)
+    {
+        head = hazard_protect(&rec->hazards[0], (void **) &queue_ptr->head);
+        tail = __atomic_load_n(&queue_ptr->tail, __ATOMIC_ACQUIRE);
+        next = hazard_protect(&rec->hazards[1], (void **) &head->next);
+        if(__atomic_load_n(&queue_ptr->head, __ATOMIC_SEQ_CST) != head)
+            continue;
+        if(next == NULL)
+        {
+            //Empty, though an earlier pass may have read an element
+            elem_ptr = NULL;
+            break;
+        }
+        if(head == tail)
+        {
+            //Never let head pass tail, swing tail on for the last push
+            __atomic_compare_exchange_n(&queue_ptr->tail, &tail, next, 0,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+            continue;
+        }
+        elem_ptr = next->data_ptr;
+        if(__atomic_compare_exchange_n(&queue_ptr->head, &head, next, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    __atomic_store_n(&rec->hazards[0], NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->hazards[1], NULL, __ATOMIC_RELEASE);
+    if(next != NULL)
+        hazard_retire(rec, head);
+    return elem_ptr;
+}
+
+/* Returns the hazard record of the calling thread, taking over a record
+ * freed by an exited thread or adding a new one on its first call.
+ */
+static hazard_rec_t *hazard_acquire(void)
+{
+    hazard_rec_t *rec = thread_hazards;
+    int idle;
+
+    if(rec != NULL)
+        return rec;
+
+    pthread_once(&hazard_once, hazard_key_create);
+    for(rec = __atomic_load_n(&hazard_records, __ATOMIC_ACQUIRE); rec != NULL;
+            rec = rec->next)
+    {
+        idle = 0;
+        if(__atomic_compare_exchange_n(&rec->active, &idle, 1, 0,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if(rec == NULL)
+    {
+        rec = (hazard_rec_t *) aligned_alloc(QUEUE_LINE, sizeof(hazard_rec_t));
+        assert(rec != NULL);
+        memset(rec, 0, sizeof(hazard_rec_t));
+        rec->active = 1;
+        rec->next = __atomic_load_n(&hazard_records, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&hazard_records, &rec->next, rec,
+                    0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        __atomic_add_fetch(&hazard_record_count, 1, __ATOMIC_RELAXED);
+    }
+    thread_hazards = rec;
+    pthread_setspecific(hazard_key, rec);
+    return rec;
+}
+
+/* Hands the record of an exiting thread back, freeing what it can first */
+static void hazard_release(void *rec)
+{
+    hazard_rec_t *hazard_rec = (hazard_rec_t *) rec;
+
+    hazard_scan(hazard_rec);
+    __atomic_store_n(&hazard_rec->active, 0, __ATOMIC_RELEASE);
+}
+
+static void hazard_key_create(void)
+{
+    pthread_key_create(&hazard_key, hazard_release);
+}
+
+/* Publishes the pointer in *src as a hazard and returns it once it is known
+ * to have stayed in *src after publishing, so that a thread that takes it out
+ * of *src later is bound to see the hazard.
+ */
+static void *hazard_protect(void **hazard, void **src)
+{
+    void *ptr, *again = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+
+    do
+    {
+        ptr = again;
+        __atomic_store_n(hazard, ptr, __ATOMIC_SEQ_CST);
+        again = __atomic_load_n(src, __ATOMIC_SEQ_CST);
+    }
+    while(again != ptr);
+    return ptr;
+}
+
+/* Puts a node that has left the queue aside until no hazard names it,
+ * scanning once a thread holds enough retired nodes to make the scan pay.
+ */
+static void hazard_retire(hazard_rec_t *rec, queue_node_t *node)
+{
+    size_t limit;
+
+    if(rec->retired_count == rec->retired_slots)
+    {
+        rec->retired_slots = rec->retired_slots * 2 + QUEUE_RETIRE_MIN;
+        rec->retired = (void **) realloc(rec->retired,
+                rec->retired_slots * sizeof(void *));
+        assert(rec->retired != NULL);
+    }
+    rec->retired[rec->retired_count++] = node;
+
+    limit = QUEUE_RETIRE_MIN + 2 * QUEUE_HAZARDS *
+        (size_t) __atomic_load_n(&hazard_record_count, __ATOMIC_RELAXED);
+    if(rec->retired_count >= limit)
+        hazard_scan(rec);
+}
+
+/* Frees the retired nodes of rec that no hazard of any thread names */
+static void hazard_scan(hazard_rec_t *rec)
+{
+    hazard_rec_t *first, *other;
+    void **hazards, *hazard;
+    size_t count = 0, slots = 0, kept = 0, i;
+
+    //Records are only ever added in front, so both walks see the same ones
+    first = __atomic_load_n(&hazard_records, __ATOMIC_ACQUIRE);
+    for(other = first; other != NULL; other = other->next)
+        slots += QUEUE_HAZARDS;
+    hazards = (void **) malloc(slots * sizeof(void *));
+    assert(hazards != NULL);
+    for(other = first; other != NULL; other = other->next)
+    {
+        for(i = 0; i < QUEUE_HAZARDS; i++)
+        {
+            hazard = __atomic_load_n(&other->hazards[i], __ATOMIC_SEQ_CST);
+            if(hazard != NULL)
+                hazards[count++] = hazard;
+        }
+    }
+    qsort(hazards, count, sizeof(void *), node_address_order);
+
+    for(i = 0; i < rec->retired_count; i++)
+    {
+        if(bsearch(&rec->retired[i], hazards, count, sizeof(void *),
+                    node_address_order) != NULL)
+            rec->retired[kept++] = rec->retired[i];
+        else
+            free(rec->retired[i]);
+    }
+    rec->retired_count = kept;
+    free(hazards);
+}
+
+#ifdef LIST_STATS
+static double stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Starts counting for an operation of kind op on the list (LIST_OPS for one
+ * that only counts comparisons).  Sorts are always timed, other operations
+ * only when latency sampling is compiled in and their turn has come.
+ */
+static stats_begin_t stats_begin_op(list_t *list_ptr, list_op_t op)
+{
+    stats_begin_t begin;
+
+    (void) list_ptr;
+    begin.compares = thread_compares;
+    begin.start_ns = 0;
+    if(op == LIST_OP_SORT)
+    {
+        begin.start_ns = stats_now_ns();
+    }
+#ifdef LIST_STATS_LATENCY
+    else if(op != LIST_OPS && list_ptr->stats_ops++ % LIST_LATENCY_SAMPLE == 0)
+    {
+        begin.start_ns = stats_now_ns();
+    }
+#endif
+    return begin;
+}
+
+/* Adds the comparisons and time of the operation started by stats_begin_op
+ * to the counters of the list.
+ */
+static void stats_end_op(list_t *list_ptr, stats_begin_t *begin, list_op_t op)
+{
+    double elapsed = 0;
+    int bucket;
+
+    list_ptr->stats.compares += thread_compares - begin->compares;
+    if(begin->start_ns == 0)
+        return;
+
+    elapsed = stats_now_ns() - begin->start_ns;
+    if(op == LIST_OP_SORT)
+    {
+        list_ptr->stats.sorts++;
+        list_ptr->stats.sort_ns += (unsigned long long) elapsed;
+    }
+#ifdef LIST_STATS_LATENCY
+    for(bucket = 0; bucket < LIST_LATENCY_BUCKETS - 1 && elapsed >= 2; bucket++)
+    {
+        elapsed /= 2;
+    }
+    list_ptr->stats.latency[op][bucket]++;
+#else
+    (void) bucket;
+#endif
+}
+#endif
+
+/* Persistence
+ *
+ * list_save writes the elements of a list, in list order, to a file that
+ * list_open_mmap maps back as a ListView.  The file starts with a
+ * view_header_t and is followed by one view_rec_t per element, each holding
+ * the offsets (from the start of the file) of its neighbours and the element
+ * bytes the serializer produced, padded to VIEW_ALIGN.  Since the links are
+ * offsets and not pointers the file works wherever it is mapped, and opening
+ * it only maps it: nothing is read or allocated per element until the view
+ * is walked, and the pages are brought in by the walk.
+ *
+ * The file is written with the header zeroed and the header is filled in
+ * last, so a file whose save did not finish is refused by list_open_mmap.
+ * Integers are stored in the byte order of the machine that saved them.
+ */
+static int view_write(FILE *file, const void *buf, size_t size)
+{
+    return size == 0 || fwrite(buf, size, 1, file) == 1;
+}
+
+/* Writes the list to the file at path, replacing it, with the bytes that
+ * ser_proc produces for each element.  ser_proc(elem_ptr, buf, buf_size)
+ * returns the size of the element's bytes, and stores them in buf only if
+ * they fit in buf_size; it is called again with a larger buffer otherwise.
+ *
+ * The list is written to path with VIEW_TMP appended, which is synced to
+ * disk and then renamed over path, so path holds either the old file or the
+ * new one, and views still mapping the old file are left intact.
+ *
+ * Returns 0, or -1 with errno set if the file could not be written, in
+ * which case path is left as it was.
+ */
+int list_save(list_t *list_ptr, const char *path, serializer ser_proc)
+{
+    FILE *file;
+    char *tmp_path;
+    int saved, saved_errno;
+
+    assert(list_ptr != NULL && path != NULL && ser_proc != NULL);
+    tmp_path = (char *) malloc(strlen(path) + sizeof(VIEW_TMP));
+    if(tmp_path == NULL)
+        return -1;
+    strcpy(tmp_path, path);
+    strcat(tmp_path, VIEW_TMP);
+    file = fopen(tmp_path, "wb");
+    if(file == NULL)
+    {
+        free(tmp_path);
+        return -1;
+    }
+
+    saved = view_save(list_ptr, file, ser_proc) && fflush(file) == 0 &&
+            fsync(fileno(file)) == 0;
+    saved_errno = errno;
+    if(fclose(file) != 0 && saved)
+    {
+        saved = 0;
+        saved_errno = errno;
+    }
+    if(saved && rename(tmp_path, path) != 0)
+    {
+        saved = 0;
+        saved_errno = errno;
+    }
+    if(!saved)
+        remove(tmp_path);
+    free(tmp_path);
+    errno = saved_errno;
+    return saved ? 0 : -1;
+}
+
+/* Does the writing for list_save.  Returns 0 if a write failed.
+ */
+static int view_save(list_t *list_ptr, FILE *file, serializer ser_proc)
+{
+    static const char zeros[VIEW_ALIGN];
+    view_header_t header;
+    view_rec_t rec;
+    list_node_t *node;
+    char *buf = NULL, *grown;
+    size_t buf_size = 0, needed, padding;
+    uint64_t offset = sizeof(header), prev = 0;
+    int written;
+
+    memset(&header, 0, sizeof(header));
+    written = view_write(file, &header, sizeof(header));
+    for(node = list_ptr->head->next; written && node != list_ptr->tail;
+            node = node->next)
+    {
+        needed = ser_proc(node->data_ptr, buf, buf_size);
+        if(needed > buf_size)
+        {
+            grown = (char *) realloc(buf, needed);
+            if(grown == NULL)
+            {
+                written = 0;
+                break;
+            }
+            buf = grown;
+            buf_size = needed;
+            needed = ser_proc(node->data_ptr, buf, buf_size);
+            assert(needed <= buf_size);
+        }
+
+        padding = (VIEW_ALIGN - needed % VIEW_ALIGN) % VIEW_ALIGN;
+        rec.prev = prev;
+        rec.next = node->next == list_ptr->tail ? 0 :
+                offset + sizeof(rec) + needed + padding;
+        rec.size = needed;
+        written = view_write(file, &rec, sizeof(rec)) &&
+                view_write(file, buf, needed) &&
+                view_write(file, zeros, padding);
+
+        if(prev == 0)
+            header.first = offset;
+        prev = offset;
+        offset += sizeof(rec) + needed + padding;
+    }
+    free(buf);
+    if(!written)
+        return 0;
+
+    //The header goes in last, so that an unfinished file has no magic
+    memcpy(header.magic, VIEW_MAGIC, sizeof(header.magic));
+    header.version = VIEW_VERSION;
+    header.sorted = list_ptr->list_sorted_state == SORTED_LIST;
+    header.count = list_ptr->current_list_size;
+    header.last = prev;
+    header.file_size = offset;
+    return fflush(file) == 0 && fseek(file, 0, SEEK_SET) == 0 &&
+            view_write(file, &header, sizeof(header));
+}
+
+/* Maps a file written by list_save and returns a view of it, or NULL with
+ * errno set if the file cannot be mapped or was not written by list_save.
+ * Takes the same time for any number of elements.
+ *
+ * The mapping is private: the elements may be changed in place through
+ * list_view_access, which copies the pages touched on their first write,
+ * and the changes are never written back to the file.
+ */
+list_view_t *list_open_mmap(const char *path)
+{
+    list_view_t *view;
+    struct stat st;
+    void *base = MAP_FAILED;
+    int fd, saved_errno;
+
+    assert(path != NULL);
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st) == 0)
+    {
+        if((size_t) st.st_size < sizeof(view_header_t))
+            errno = EINVAL;
+        else
+            base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+    }
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    if(base == MAP_FAILED)
+        return NULL;
+
+    if(!view_header_valid((view_header_t *) base, st.st_size))
+    {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    view = (list_view_t *) malloc(sizeof(list_view_t));
+    if(view == NULL)
+    {
+        munmap(base, st.st_size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    view->base = (char *) base;
+    view->length = st.st_size;
+    return view;
+}
+
+/* Returns 1 if the header is that of a complete list_save file of length
+ * bytes.  The records themselves are checked as the view is walked, by
+ * view_rec_at, so that opening takes the same time for any file.
+ */
+static int view_header_valid(view_header_t *header, size_t length)
+{
+    return memcmp(header->magic, VIEW_MAGIC, sizeof(header->magic)) == 0 &&
+            header->version == VIEW_VERSION &&
+            header->file_size == length &&
+            header->first <= length - sizeof(view_rec_t) &&
+            header->last <= length - sizeof(view_rec_t) &&
+            header->count <= length / sizeof(view_rec_t);
+}
+
+/* Unmaps the view.  Pointers from list_view_access into it become invalid.
+ */
+void list_view_close(list_view_t *view)
+{
+    assert(view != NULL);
+    munmap(view->base, view->length);
+    free(view);
+}
+
+int list_view_size(list_view_t *view)
+{
+    assert(view != NULL);
+    return (int) ((view_header_t *) view->base)->count;
+}
+
+/* Returns 1 if the list was sorted when it was saved.
+ */
+int list_view_sorted(list_view_t *view)
+{
+    assert(view != NULL);
+    return ((view_header_t *) view->base)->sorted != 0;
+}
+
+/* The first and last elements of the view, and the ones after and before an
+ * element.  All return NULL past the ends of the view, and where a damaged
+ * file links to something that is not a record, see view_rec_at.
+ */
+view_rec_t *list_view_first(list_view_t *view)
+{
+    assert(view != NULL);
+    return view_rec_at(view, ((view_header_t *) view->base)->first);
+}
+
+view_rec_t *list_view_last(list_view_t *view)
+{
+    assert(view != NULL);
+    return view_rec_at(view, ((view_header_t *) view->base)->last);
+}
+
+view_rec_t *list_view_next(list_view_t *view, view_rec_t *idx_ptr)
+{
+    assert(view != NULL && idx_ptr != NULL);
+    return view_rec_at(view, idx_ptr->next);
+}
+
+view_rec_t *list_view_prev(list_view_t *view, view_rec_t *idx_ptr)
+{
+    assert(view != NULL && idx_ptr != NULL);
+    return view_rec_at(view, idx_ptr->prev);
+}
+
+/* Returns the bytes saved for the element, aligned to VIEW_ALIGN, and
+ * stores their size in *size unless size is NULL.
+ */
+void * list_view_access(list_view_t *view, view_rec_t *idx_ptr, size_t *size)
+{
+    assert(view != NULL && idx_ptr != NULL);
+    if(size != NULL)
+        *size = idx_ptr->size;
+    return idx_ptr + 1;
+}
+
+/* Turns the offset of a record into a pointer into the mapping, or NULL if
+ * the offset is 0, which is the header and ends the view, or is not that of
+ * a record lying wholly inside the file.  A damaged file is thus walked only
+ * as far as its links hold, and never outside the mapping.
+ */
+static view_rec_t *view_rec_at(list_view_t *view, uint64_t offset)
+{
+    view_rec_t *rec;
+
+    if(offset < sizeof(view_header_t) || offset % VIEW_ALIGN != 0 ||
+            offset > view->length - sizeof(view_rec_t))
+        return NULL;
+    rec = (view_rec_t *) (view->base + offset);
+    if(rec->size > view->length - offset - sizeof(view_rec_t))
+        return NULL;
+    return rec;
+}
 
 /* This function verifies that the pointers for the two-way linked list are
  * valid, and that the list size matches the number of items in the list.
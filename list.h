@@ -6,7 +6,52 @@
 #ifndef _MYLIST_H_
 #define _MYLIST_H_
 
+#include <stddef.h>
+
 typedef int (*comparer)(void *, void *);
+typedef unsigned long (*hasher)(void *);
+
+/* keys for list_sort_by_key and set_key_column; the key_extractor sets the
+ * member that matches the list_key_kind_t passed along with it */
+typedef union list_key_tag {
+    int i32;
+    long long i64;
+    unsigned long long u64;
+    const char *str;
+} list_key_t;
+
+typedef enum {
+    LIST_KEY_INT32,
+    LIST_KEY_INT64,
+    LIST_KEY_UINT64,
+    LIST_KEY_STRING
+} list_key_kind_t;
+
+typedef list_key_t (*key_extractor)(void *elem_ptr);
+
+/* callbacks of list_foreach, list_map_inplace, list_filter and list_reduce;
+ * the last argument is the arg passed to those */
+typedef void (*visitor)(void *elem_ptr, void *arg);
+typedef void *(*mapper)(void *elem_ptr, void *arg);
+typedef int (*predicate)(void *elem_ptr, void *arg);
+typedef void (*reducer)(void *acc, void *elem_ptr, void *arg);
+typedef void (*combiner)(void *acc, void *other_acc, void *arg);
+
+/* writes the bytes list_save keeps for an element, see list_save */
+typedef size_t (*serializer)(void *elem_ptr, void *buf, size_t buf_size);
+
+/* node pool, skip list, order statistic and hash indexes, key column,
+ * concurrent and priority queues, and saved list views, private to list.c */
+struct list_pool_tag;
+struct list_skip_tag;
+struct list_rank_tag;
+struct list_hash_tag;
+struct list_keys_tag;
+struct list_queue_tag;
+struct list_pq_tag;
+struct list_pq_node_tag;
+struct list_view_tag;
+struct list_view_rec_tag;
 
 typedef struct list_node_tag {
     /* private members for list.c only */
@@ -15,6 +60,38 @@ typedef struct list_node_tag {
     void *data_ptr;
 } list_node_t;
 
+/* Per list performance counters
+ *
+ * Kept only when list.c is compiled with -DLIST_STATS; otherwise the
+ * counting code compiles to nothing and list_stats reports zeros.  With
+ * -DLIST_STATS_LATENCY as well, one in LIST_LATENCY_SAMPLE operations of each
+ * kind is timed into a histogram whose bucket i counts operations that took
+ * from 2^i up to 2^(i+1) nanoseconds.  Every sort is timed.  LIST_STATS
+ * changes the layout of list_t, so define it for every file including list.h.
+ */
+#define LIST_LATENCY_BUCKETS 32
+#define LIST_LATENCY_SAMPLE  64
+
+typedef enum {
+    LIST_OP_INSERT,
+    LIST_OP_INSERT_SORTED,
+    LIST_OP_FIND,
+    LIST_OP_REMOVE,
+    LIST_OP_SORT,
+    LIST_OPS
+} list_op_t;
+
+typedef struct list_stats_tag {
+    unsigned long long compares;            /* calls of the comparison function */
+    unsigned long long nodes_traversed;     /* by list_elem_find and list_insert_sorted */
+    unsigned long long node_allocs;
+    unsigned long long node_frees;
+    unsigned long long sorts;
+    unsigned long long sort_ns;             /* total time spent sorting */
+    unsigned long long unsorted_transitions; /* sorted lists made unsorted by list_insert */
+    unsigned long long latency[LIST_OPS][LIST_LATENCY_BUCKETS];
+} list_stats_t;
+
 typedef struct list_tag {
     /* private members for list.c only */
     list_node_t *head;
@@ -22,17 +99,58 @@ typedef struct list_tag {
     int current_list_size;
     int list_sorted_state;
     comparer comp_proc;
+    struct list_pool_tag *node_pool;
+    struct list_skip_tag *skip_index;
+    struct list_rank_tag *rank_index;
+    struct list_hash_tag *hash_index;
+    struct list_keys_tag *key_column;
+    int link_offset;            /* -1 unless the list is intrusive */
+    list_node_t *sorted_tail;   /* last node of the sorted prefix when unsorted */
+    list_node_t *finger;        /* last node inserted sorted or found, or NULL */
+#ifdef LIST_STATS
+    list_stats_t stats;
+    unsigned long long stats_ops;   /* operations counted towards sampling */
+#endif
 } list_t;
 
 /* public definition of pointer into linked list */
 typedef list_node_t * Iterator;
 typedef list_t * List;
+typedef struct list_queue_tag * ListQueue;
+typedef struct list_pq_tag * PQueue;
+typedef struct list_pq_node_tag * PQHandle;
+typedef struct list_view_tag * ListView;
+typedef struct list_view_rec_tag * ViewIter;
+
+/* Intrusive lists: a record that is kept on an intrusive list embeds a
+ * list_link_t, and the list links the records through it instead of
+ * allocating a node per element.  The record itself is the element, so
+ * list_access, list_remove, and the comparison function all see the record.
+ * list_entry recovers the record from an Iterator.
+ *
+ *     struct job { int prio; list_link_t link; };
+ *     List jobs = list_construct_intrusive_of(struct job, link);
+ *     list_insert(jobs, &job, list_iter_tail(jobs));
+ *     struct job *j = list_entry(list_iter_first(jobs), struct job, link);
+ */
+typedef list_node_t list_link_t;
+
+#define list_entry(idx_ptr, type, member) \
+    ((type *) ((char *) (idx_ptr) - offsetof(type, member)))
+#define list_construct_intrusive_of(type, member) \
+    list_construct_intrusive(offsetof(type, member))
 
 /* public prototype definitions for list.c */
 
 /* build and cleanup lists */
 void set_comp(List, comparer);
+void set_hash(List, hasher);
+void set_key_column(List, key_extractor, list_key_kind_t);
+void list_use_skip_index(List, int enable);
 List list_construct(void);
+List list_construct_capacity(int capacity_hint);
+List list_construct_shared(List share_with);
+List list_construct_intrusive(size_t link_offset);
 void list_destruct(List list_ptr);
 
 /* iterators into positions in the list */
@@ -42,14 +160,111 @@ Iterator list_iter_next(Iterator idx_ptr);
 
 void * list_access(List list_ptr, Iterator idx_ptr);
 Iterator list_elem_find(List list_ptr, void *elem_ptr);
+Iterator list_key_find(List list_ptr, list_key_t lo, list_key_t hi);
+int list_key_count(List list_ptr, list_key_t lo, list_key_t hi);
 
 void list_insert(List list_ptr, void *elem_ptr, Iterator idx_ptr);
 void list_insert_sorted(List list_ptr, void *elem_ptr);
+void list_insert_sorted_hint(List list_ptr, void *elem_ptr, Iterator hint);
 
 void * list_remove(List list_ptr, Iterator idx_ptr);
+
+/* moving ranges of elements without copying them */
+void list_splice(List dst, Iterator pos, List src, Iterator first, Iterator last);
+void list_append_list(List dst, List src);
+void list_insert_array(List list_ptr, void **elems, int count, Iterator idx_ptr);
+List list_remove_range(List list_ptr, Iterator first, Iterator last);
+
+/* set algebra on sorted lists, see list_merge_sorted */
+void list_merge_sorted(List dst, List src);
+void list_union(List dst, List src);
+List list_intersect(List list_ptr, List other);
+List list_difference(List list_ptr, List other);
+List list_unique(List list_ptr);
+void list_merge_many(List *lists, int count);
+
 void list_sort(List);
+void list_sort_parallel(List, int nthreads);
+void list_sort_array(List);
+void list_sort_by_key(List, key_extractor, list_key_kind_t);
+void list_compact(List);
+void list_partial_sort(List list_ptr, int k);
+Iterator list_nth_element(List list_ptr, int n);
+
+/* parallel traversal, see list_foreach */
+void list_foreach(List list_ptr, visitor visit_proc, void *arg, int nthreads);
+void list_map_inplace(List list_ptr, mapper map_proc, void *arg, int nthreads);
+List list_filter(List list_ptr, predicate keep_proc, void *arg, int nthreads);
+void list_reduce(List list_ptr, void *acc, size_t acc_size,
+        reducer reduce_proc, combiner combine_proc, void *arg, int nthreads);
 
 int list_size(List list_ptr);
+
+/* positional access, see list_at */
+Iterator list_at(List list_ptr, size_t index);
+size_t list_index_of(List list_ptr, Iterator idx_ptr);
+void list_range(List list_ptr, size_t from, size_t to, Iterator *first,
+        Iterator *last);
+
+/* Concurrent queues: unlike a List, a ListQueue may be used by any number
+ * of threads at once without locking.  Producers push at the back and
+ * consumers pop from the front; neither ever blocks the other.  Elements
+ * must not be NULL, which list_queue_pop returns when the queue is empty.
+ *
+ *     ListQueue work = list_queue_construct();
+ *     list_queue_push(work, job);                 (any thread)
+ *     while((job = list_queue_pop(work)) != NULL) (any thread)
+ *         run(job);
+ */
+ListQueue list_queue_construct(void);
+void list_queue_destruct(ListQueue queue_ptr);
+void list_queue_push(ListQueue queue_ptr, void *elem_ptr);
+void * list_queue_pop(ListQueue queue_ptr);
+
+/* Priority queues: a PQueue keeps elements in the order of its comparison
+ * function like a sorted List, but pushes in O(1) and pops the first element
+ * in O(log n) amortized time.  Equal elements pop in push order.  The handle
+ * returned by pq_push lets an element that was changed to rank earlier move
+ * up with pq_decrease_key.
+ */
+PQueue pq_construct(void);
+void pq_set_comp(PQueue pq, comparer comp_proc);
+void pq_destruct(PQueue pq);
+PQHandle pq_push(PQueue pq, void *elem_ptr);
+void * pq_peek(PQueue pq);
+void * pq_pop(PQueue pq);
+void pq_decrease_key(PQueue pq, PQHandle handle);
+int pq_size(PQueue pq);
+
+/* Persistence: list_save writes a list to a file that list_open_mmap maps
+ * back as a read only ListView, without reading or allocating anything per
+ * element, so a saved list is available at once however long it is.  A view
+ * is walked like a List, with NULL past either end, and list_view_access
+ * gives the element bytes the serializer wrote, in place in the mapping.
+ * Writing to them changes only the caller's private copy of the page.  A
+ * damaged file is walked only as far as its links are sound.
+ *
+ *     list_save(jobs, "jobs.list", job_serialize);
+ *     ListView saved = list_open_mmap("jobs.list");
+ *     for(ViewIter it = list_view_first(saved); it != NULL;
+ *             it = list_view_next(saved, it))
+ *         run((struct job *) list_view_access(saved, it, NULL));
+ *     list_view_close(saved);
+ */
+int list_save(List list_ptr, const char *path, serializer ser_proc);
+ListView list_open_mmap(const char *path);
+void list_view_close(ListView view);
+int list_view_size(ListView view);
+int list_view_sorted(ListView view);
+ViewIter list_view_first(ListView view);
+ViewIter list_view_last(ListView view);
+ViewIter list_view_next(ListView view, ViewIter idx_ptr);
+ViewIter list_view_prev(ListView view, ViewIter idx_ptr);
+void * list_view_access(ListView view, ViewIter idx_ptr, size_t *size);
+
+/* performance counters, see list_stats_t */
+int list_stats(List list_ptr, list_stats_t *stats);
+void list_stats_reset(List list_ptr);
 #endif
 
 /* commands for vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
@@ -0,0 +1,559 @@
+/* list_typed.h
+ *
+ * Compile-time specialized two-way linked lists
+ *
+ * LIST_DEFINE(name, elem_type, cmp_expr) generates a list type name_t whose
+ * nodes hold an elem_type by value, together with the same set of
+ * operations as list.h, all prefixed with name_ instead of list_:
+ *
+ *     name_t *name_construct(void);
+ *     void name_destruct(name_t *);
+ *     name_node_t *name_iter_first(name_t *);
+ *     name_node_t *name_iter_tail(name_t *);
+ *     name_node_t *name_iter_next(name_node_t *);
+ *     elem_type *name_access(name_t *, name_node_t *);
+ *     name_node_t *name_elem_find(name_t *, elem_type);
+ *     void name_insert(name_t *, elem_type, name_node_t *);
+ *     void name_insert_sorted(name_t *, elem_type);
+ *     elem_type name_remove(name_t *, name_node_t *);
+ *     void name_sort(name_t *);
+ *     int name_size(name_t *);
+ *
+ * cmp_expr is an expression in the two elements a and b (both elem_type)
+ * that follows the comparer convention of list.h: 1 if a should be closer
+ * to the head than b, -1 if b should be, 0 if they are equal in rank.  It is
+ * compiled into every operation, so there is no function pointer call per
+ * comparison.  For example
+ *
+ *     LIST_DEFINE(intlist, int, (a < b) - (a > b))
+ *
+ * The semantics follow list.c: list_insert marks the list unsorted,
+ * list_insert_sorted requires a sorted list and places an element after the
+ * ones of equal rank, list_elem_find returns the first match or NULL, and
+ * the sort is a stable bottom-up merge sort.  Since elements are stored by
+ * value, destruct and remove free nothing but nodes.
+ *
+ * The List type of list.h remains the generic instantiation for elements
+ * handled through void pointers.
+ *
+ * LIST_DEFINE_COMPACT(name, elem_type, cmp_expr) generates the same list
+ * with the nodes kept in an arena and linked by LIST_COMPACT_INDEX indices
+ * (uint32_t unless defined before including this file) instead of pointers.
+ * On 64-bit targets that halves the link overhead of every node, which is
+ * what dominates huge lists of small elements.  The arena grows by segments
+ * of 2^LIST_COMPACT_SEGMENT_BITS nodes, so it never copies nodes and their
+ * addresses stay valid.  An iterator is a name_iter_t node index, 0 being
+ * the head and 1 the tail, so iter_next needs the list:
+ *
+ *     name_iter_t name_iter_next(name_t *, name_iter_t);
+ *
+ * elem_find returns 0 when nothing matches, and size returns a uint64_t.  The
+ * other operations keep their LIST_DEFINE signatures with name_iter_t in
+ * place of name_node_t *.  Running out of indices is an assertion failure;
+ * define LIST_COMPACT_INDEX as uint64_t for lists beyond 2^32 - 2 nodes.
+ */
+#ifndef _MYLIST_TYPED_H_
+#define _MYLIST_TYPED_H_
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#define LIST_TYPED_SORTED   1
+#define LIST_TYPED_UNSORTED 0
+#define LIST_TYPED_BINS     64
+
+#ifndef LIST_COMPACT_INDEX
+#define LIST_COMPACT_INDEX uint32_t
+#endif
+#ifndef LIST_COMPACT_SEGMENT_BITS
+#define LIST_COMPACT_SEGMENT_BITS 16
+#endif
+#define LIST_COMPACT_SEGMENT ((uint64_t) 1 << LIST_COMPACT_SEGMENT_BITS)
+
+#define LIST_DEFINE(name, elem_type, cmp_expr)                                \
+                                                                              \
+typedef struct name##_node_tag {                                              \
+    struct name##_node_tag *prev;                                             \
+    struct name##_node_tag *next;                                             \
+    elem_type data;                                                           \
+} name##_node_t;                                                              \
+                                                                              \
+typedef struct name##_tag {                                                   \
+    /* private members, the dummy head and tail are part of the header */     \
+    name##_node_t head;                                                       \
+    name##_node_t tail;                                                       \
+    name##_node_t *free_nodes;                                                \
+    int current_list_size;                                                    \
+    int list_sorted_state;                                                    \
+} name##_t;                                                                   \
+                                                                              \
+static inline int name##_comp(elem_type a, elem_type b)                       \
+{                                                                             \
+    return (cmp_expr);                                                        \
+}                                                                             \
+                                                                              \
+static inline name##_t *name##_construct(void)                                \
+{                                                                             \
+    name##_t *L = (name##_t *) malloc(sizeof(name##_t));                      \
+                                                                              \
+    assert(L != NULL);                                                        \
+    L->head.prev = NULL;                                                      \
+    L->head.next = &L->tail;                                                  \
+    L->tail.prev = &L->head;                                                  \
+    L->tail.next = NULL;                                                      \
+    L->free_nodes = NULL;                                                     \
+    L->current_list_size = 0;                                                 \
+    L->list_sorted_state = LIST_TYPED_SORTED;                                 \
+    return L;                                                                 \
+}                                                                             \
+                                                                              \
+static inline void name##_destruct(name##_t *list_ptr)                        \
+{                                                                             \
+    name##_node_t *node, *next;                                               \
+                                                                              \
+    for(node = list_ptr->head.next; node != &list_ptr->tail; node = next)     \
+    {                                                                         \
+        next = node->next;                                                    \
+        free(node);                                                           \
+    }                                                                         \
+    for(node = list_ptr->free_nodes; node != NULL; node = next)               \
+    {                                                                         \
+        next = node->next;                                                    \
+        free(node);                                                           \
+    }                                                                         \
+    free(list_ptr);                                                           \
+}                                                                             \
+                                                                              \
+static inline name##_node_t *name##_iter_first(name##_t *list_ptr)            \
+{                                                                             \
+    return list_ptr->head.next;                                               \
+}                                                                             \
+                                                                              \
+static inline name##_node_t *name##_iter_tail(name##_t *list_ptr)             \
+{                                                                             \
+    return &list_ptr->tail;                                                   \
+}                                                                             \
+                                                                              \
+static inline name##_node_t *name##_iter_next(name##_node_t *idx_ptr)         \
+{                                                                             \
+    assert(idx_ptr != NULL && idx_ptr->next != NULL);                         \
+    return idx_ptr->next;                                                     \
+}                                                                             \
+                                                                              \
+static inline elem_type *name##_access(name##_t *list_ptr,                    \
+        name##_node_t *idx_ptr)                                               \
+{                                                                             \
+    if(idx_ptr == &list_ptr->head || idx_ptr == &list_ptr->tail)              \
+        return NULL;                                                          \
+    return &idx_ptr->data;                                                    \
+}                                                                             \
+                                                                              \
+static inline int name##_size(name##_t *list_ptr)                             \
+{                                                                             \
+    return list_ptr->current_list_size;                                       \
+}                                                                             \
+                                                                              \
+static inline name##_node_t *name##_elem_find(name##_t *list_ptr,             \
+        elem_type elem)                                                       \
+{                                                                             \
+    name##_node_t *node;                                                      \
+                                                                              \
+    for(node = list_ptr->head.next; node != &list_ptr->tail;                  \
+            node = node->next)                                                \
+    {                                                                         \
+        if(name##_comp(elem, node->data) == 0)                                \
+            return node;                                                      \
+    }                                                                         \
+    return NULL;                                                              \
+}                                                                             \
+                                                                              \
+/* links a new node holding elem in front of idx_ptr */                       \
+static inline void name##_link(name##_t *list_ptr, elem_type elem,            \
+        name##_node_t *idx_ptr)                                               \
+{                                                                             \
+    name##_node_t *node = list_ptr->free_nodes;                               \
+                                                                              \
+    if(node != NULL)                                                          \
+        list_ptr->free_nodes = node->next;                                    \
+    else                                                                      \
+        node = (name##_node_t *) malloc(sizeof(name##_node_t));               \
+    assert(node != NULL);                                                     \
+    node->data = elem;                                                        \
+    node->next = idx_ptr;                                                     \
+    node->prev = idx_ptr->prev;                                               \
+    node->prev->next = node;                                                  \
+    idx_ptr->prev = node;                                                     \
+    list_ptr->current_list_size++;                                            \
+}                                                                             \
+                                                                              \
+static inline void name##_insert(name##_t *list_ptr, elem_type elem,          \
+        name##_node_t *idx_ptr)                                               \
+{                                                                             \
+    name##_link(list_ptr, elem, idx_ptr);                                     \
+    list_ptr->list_sorted_state = LIST_TYPED_UNSORTED;                        \
+}                                                                             \
+                                                                              \
+static inline void name##_insert_sorted(name##_t *list_ptr, elem_type elem)   \
+{                                                                             \
+    name##_node_t *node = list_ptr->head.next;                                \
+                                                                              \
+    assert(list_ptr->list_sorted_state == LIST_TYPED_SORTED);                 \
+    while(node != &list_ptr->tail && name##_comp(elem, node->data) != 1)      \
+        node = node->next;                                                    \
+    name##_link(list_ptr, elem, node);                                        \
+}                                                                             \
+                                                                              \
+static inline elem_type name##_remove(name##_t *list_ptr,                     \
+        name##_node_t *idx_ptr)                                               \
+{                                                                             \
+    assert(idx_ptr != &list_ptr->head && idx_ptr != &list_ptr->tail);         \
+    assert(list_ptr->current_list_size > 0);                                  \
+    idx_ptr->next->prev = idx_ptr->prev;                                      \
+    idx_ptr->prev->next = idx_ptr->next;                                      \
+    idx_ptr->next = list_ptr->free_nodes;                                     \
+    list_ptr->free_nodes = idx_ptr;                                           \
+    list_ptr->current_list_size--;                                            \
+    return idx_ptr->data;                                                     \
+}                                                                             \
+                                                                              \
+static inline name##_node_t *name##_merge_chains(name##_node_t *chain_l,      \
+        name##_node_t *chain_r)                                               \
+{                                                                             \
+    name##_node_t *first;                                                     \
+    name##_node_t **link = &first;                                            \
+                                                                              \
+    while(chain_l != NULL && chain_r != NULL)                                 \
+    {                                                                         \
+        if(name##_comp(chain_l->data, chain_r->data) != -1)                   \
+        {                                                                     \
+            *link = chain_l;                                                  \
+            link = &chain_l->next;                                            \
+            chain_l = chain_l->next;                                          \
+        }                                                                     \
+        else                                                                  \
+        {                                                                     \
+            *link = chain_r;                                                  \
+            link = &chain_r->next;                                            \
+            chain_r = chain_r->next;                                          \
+        }                                                                     \
+    }                                                                         \
+    *link = chain_l != NULL ? chain_l : chain_r;                              \
+    return first;                                                             \
+}                                                                             \
+                                                                              \
+/* same bottom-up merge sort over the next chain as merge_sort in list.c */   \
+static inline void name##_sort(name##_t *list_ptr)                            \
+{                                                                             \
+    name##_node_t *bins[LIST_TYPED_BINS];                                     \
+    name##_node_t *chain, *run, *prev;                                        \
+    int i, used = 0;                                                          \
+                                                                              \
+    if(list_ptr->current_list_size > 1)                                       \
+    {                                                                         \
+        chain = list_ptr->head.next;                                          \
+        list_ptr->tail.prev->next = NULL;                                     \
+        while(chain != NULL)                                                  \
+        {                                                                     \
+            run = chain;                                                      \
+            chain = chain->next;                                              \
+            run->next = NULL;                                                 \
+            for(i = 0; i < used && bins[i] != NULL; i++)                      \
+            {                                                                 \
+                run = name##_merge_chains(bins[i], run);                      \
+                bins[i] = NULL;                                               \
+            }                                                                 \
+            if(i == used)                                                     \
+                used++;                                                       \
+            bins[i] = run;                                                    \
+        }                                                                     \
+        run = NULL;                                                           \
+        for(i = 0; i < used; i++)                                             \
+        {                                                                     \
+            if(bins[i] != NULL)                                               \
+                run = run == NULL ? bins[i] :                                 \
+                    name##_merge_chains(bins[i], run);                        \
+        }                                                                     \
+                                                                              \
+        /* relink the prev pointers in one pass */                            \
+        prev = &list_ptr->head;                                               \
+        for(; run != NULL; run = run->next)                                   \
+        {                                                                     \
+            prev->next = run;                                                 \
+            run->prev = prev;                                                 \
+            prev = run;                                                       \
+        }                                                                     \
+        prev->next = &list_ptr->tail;                                         \
+        list_ptr->tail.prev = prev;                                           \
+    }                                                                         \
+    list_ptr->list_sorted_state = LIST_TYPED_SORTED;                          \
+}
+
+#define LIST_DEFINE_COMPACT(name, elem_type, cmp_expr)                        \
+                                                                              \
+typedef LIST_COMPACT_INDEX name##_iter_t;                                     \
+                                                                              \
+typedef struct name##_node_tag {                                              \
+    name##_iter_t prev;                                                       \
+    name##_iter_t next;                                                       \
+    elem_type data;                                                           \
+} name##_node_t;                                                              \
+                                                                              \
+typedef struct name##_tag {                                                   \
+    /* private members, node 0 is the dummy head and node 1 the dummy tail */ \
+    name##_node_t **segments;                                                 \
+    uint64_t segment_count;                                                   \
+    uint64_t segment_slots;                                                   \
+    uint64_t nodes_used;      /* node indices handed out so far */            \
+    name##_iter_t free_nodes; /* 0 if there are none */                       \
+    uint64_t current_list_size;                                               \
+    int list_sorted_state;                                                    \
+} name##_t;                                                                   \
+                                                                              \
+static inline int name##_comp(elem_type a, elem_type b)                       \
+{                                                                             \
+    return (cmp_expr);                                                        \
+}                                                                             \
+                                                                              \
+static inline name##_node_t *name##_node(name##_t *list_ptr, uint64_t idx)    \
+{                                                                             \
+    return &list_ptr->segments[idx >> LIST_COMPACT_SEGMENT_BITS]              \
+        [idx & (LIST_COMPACT_SEGMENT - 1)];                                   \
+}                                                                             \
+                                                                              \
+/* takes a node off the free list or the arena, adding a segment if needed */ \
+static inline name##_iter_t name##_alloc(name##_t *list_ptr)                  \
+{                                                                             \
+    name##_iter_t idx = list_ptr->free_nodes;                                 \
+    uint64_t segment;                                                         \
+                                                                              \
+    if(idx != 0)                                                              \
+    {                                                                         \
+        list_ptr->free_nodes = name##_node(list_ptr, idx)->next;              \
+        return idx;                                                           \
+    }                                                                         \
+    assert(list_ptr->nodes_used <= (name##_iter_t) ~(name##_iter_t) 0);       \
+    segment = list_ptr->nodes_used >> LIST_COMPACT_SEGMENT_BITS;              \
+    if(segment == list_ptr->segment_count)                                    \
+    {                                                                         \
+        if(segment == list_ptr->segment_slots)                                \
+        {                                                                     \
+            list_ptr->segment_slots = list_ptr->segment_slots * 2 + 1;        \
+            list_ptr->segments = (name##_node_t **) realloc(                  \
+                    list_ptr->segments,                                       \
+                    list_ptr->segment_slots * sizeof(name##_node_t *));       \
+            assert(list_ptr->segments != NULL);                               \
+        }                                                                     \
+        list_ptr->segments[segment] = (name##_node_t *)                       \
+            malloc(LIST_COMPACT_SEGMENT * sizeof(name##_node_t));             \
+        assert(list_ptr->segments[segment] != NULL);                          \
+        list_ptr->segment_count++;                                            \
+    }                                                                         \
+    return (name##_iter_t) list_ptr->nodes_used++;                            \
+}                                                                             \
+                                                                              \
+static inline name##_t *name##_construct(void)                                \
+{                                                                             \
+    name##_t *L = (name##_t *) calloc(1, sizeof(name##_t));                   \
+                                                                              \
+    assert(L != NULL);                                                        \
+    name##_alloc(L);                                                          \
+    name##_alloc(L);                                                          \
+    name##_node(L, 0)->prev = 0;                                              \
+    name##_node(L, 0)->next = 1;                                              \
+    name##_node(L, 1)->prev = 0;                                              \
+    name##_node(L, 1)->next = 0;                                              \
+    L->list_sorted_state = LIST_TYPED_SORTED;                                 \
+    return L;                                                                 \
+}                                                                             \
+                                                                              \
+static inline void name##_destruct(name##_t *list_ptr)                        \
+{                                                                             \
+    uint64_t i;                                                               \
+                                                                              \
+    for(i = 0; i < list_ptr->segment_count; i++)                              \
+        free(list_ptr->segments[i]);                                          \
+    free(list_ptr->segments);                                                 \
+    free(list_ptr);                                                           \
+}                                                                             \
+                                                                              \
+static inline name##_iter_t name##_iter_first(name##_t *list_ptr)             \
+{                                                                             \
+    return name##_node(list_ptr, 0)->next;                                    \
+}                                                                             \
+                                                                              \
+static inline name##_iter_t name##_iter_tail(name##_t *list_ptr)              \
+{                                                                             \
+    (void) list_ptr;                                                          \
+    return 1;                                                                 \
+}                                                                             \
+                                                                              \
+static inline name##_iter_t name##_iter_next(name##_t *list_ptr,              \
+        name##_iter_t idx)                                                    \
+{                                                                             \
+    assert(idx != 1);                                                         \
+    return name##_node(list_ptr, idx)->next;                                  \
+}                                                                             \
+                                                                              \
+static inline elem_type *name##_access(name##_t *list_ptr, name##_iter_t idx) \
+{                                                                             \
+    if(idx <= 1)                                                              \
+        return NULL;                                                          \
+    return &name##_node(list_ptr, idx)->data;                                 \
+}                                                                             \
+                                                                              \
+static inline uint64_t name##_size(name##_t *list_ptr)                        \
+{                                                                             \
+    return list_ptr->current_list_size;                                       \
+}                                                                             \
+                                                                              \
+static inline name##_iter_t name##_elem_find(name##_t *list_ptr,              \
+        elem_type elem)                                                       \
+{                                                                             \
+    name##_iter_t idx;                                                        \
+    name##_node_t *node;                                                      \
+                                                                              \
+    for(idx = name##_node(list_ptr, 0)->next; idx != 1; idx = node->next)     \
+    {                                                                         \
+        node = name##_node(list_ptr, idx);                                    \
+        if(name##_comp(elem, node->data) == 0)                                \
+            return idx;                                                       \
+    }                                                                         \
+    return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* links a new node holding elem in front of idx */                           \
+static inline void name##_link(name##_t *list_ptr, elem_type elem,            \
+        name##_iter_t idx)                                                    \
+{                                                                             \
+    name##_iter_t new_idx = name##_alloc(list_ptr);                           \
+    name##_node_t *node = name##_node(list_ptr, new_idx);                     \
+    name##_node_t *next = name##_node(list_ptr, idx);                         \
+                                                                              \
+    node->data = elem;                                                        \
+    node->next = idx;                                                         \
+    node->prev = next->prev;                                                  \
+    name##_node(list_ptr, node->prev)->next = new_idx;                        \
+    next->prev = new_idx;                                                     \
+    list_ptr->current_list_size++;                                            \
+}                                                                             \
+                                                                              \
+static inline void name##_insert(name##_t *list_ptr, elem_type elem,          \
+        name##_iter_t idx)                                                    \
+{                                                                             \
+    name##_link(list_ptr, elem, idx);                                         \
+    list_ptr->list_sorted_state = LIST_TYPED_UNSORTED;                        \
+}                                                                             \
+                                                                              \
+static inline void name##_insert_sorted(name##_t *list_ptr, elem_type elem)   \
+{                                                                             \
+    name##_iter_t idx = name##_node(list_ptr, 0)->next;                       \
+    name##_node_t *node;                                                      \
+                                                                              \
+    assert(list_ptr->list_sorted_state == LIST_TYPED_SORTED);                 \
+    for(; idx != 1; idx = node->next)                                         \
+    {                                                                         \
+        node = name##_node(list_ptr, idx);                                    \
+        if(name##_comp(elem, node->data) == 1)                                \
+            break;                                                            \
+    }                                                                         \
+    name##_link(list_ptr, elem, idx);                                         \
+}                                                                             \
+                                                                              \
+static inline elem_type name##_remove(name##_t *list_ptr, name##_iter_t idx)  \
+{                                                                             \
+    name##_node_t *node;                                                      \
+                                                                              \
+    assert(idx > 1 && list_ptr->current_list_size > 0);                       \
+    node = name##_node(list_ptr, idx);                                        \
+    name##_node(list_ptr, node->next)->prev = node->prev;                     \
+    name##_node(list_ptr, node->prev)->next = node->next;                     \
+    node->next = list_ptr->free_nodes;                                        \
+    list_ptr->free_nodes = idx;                                               \
+    list_ptr->current_list_size--;                                            \
+    return node->data;                                                        \
+}                                                                             \
+                                                                              \
+/* merges two sorted chains of next links ending in 0 */                      \
+static inline name##_iter_t name##_merge_chains(name##_t *list_ptr,           \
+        name##_iter_t chain_l, name##_iter_t chain_r)                         \
+{                                                                             \
+    name##_iter_t first = 0;                                                  \
+    name##_iter_t *link = &first;                                             \
+    name##_node_t *node_l, *node_r;                                           \
+                                                                              \
+    while(chain_l != 0 && chain_r != 0)                                       \
+    {                                                                         \
+        node_l = name##_node(list_ptr, chain_l);                              \
+        node_r = name##_node(list_ptr, chain_r);                              \
+        if(name##_comp(node_l->data, node_r->data) != -1)                     \
+        {                                                                     \
+            *link = chain_l;                                                  \
+            link = &node_l->next;                                             \
+            chain_l = node_l->next;                                           \
+        }                                                                     \
+        else                                                                  \
+        {                                                                     \
+            *link = chain_r;                                                  \
+            link = &node_r->next;                                             \
+            chain_r = node_r->next;                                           \
+        }                                                                     \
+    }                                                                         \
+    *link = chain_l != 0 ? chain_l : chain_r;                                 \
+    return first;                                                             \
+}                                                                             \
+                                                                              \
+/* the bottom-up merge sort of LIST_DEFINE over index chains */               \
+static inline void name##_sort(name##_t *list_ptr)                            \
+{                                                                             \
+    name##_iter_t bins[LIST_TYPED_BINS];                                      \
+    name##_iter_t chain, run, prev;                                           \
+    name##_node_t *node;                                                      \
+    int i, used = 0;                                                          \
+                                                                              \
+    if(list_ptr->current_list_size > 1)                                       \
+    {                                                                         \
+        chain = name##_node(list_ptr, 0)->next;                               \
+        name##_node(list_ptr, name##_node(list_ptr, 1)->prev)->next = 0;      \
+        while(chain != 0)                                                     \
+        {                                                                     \
+            run = chain;                                                      \
+            node = name##_node(list_ptr, run);                                \
+            chain = node->next;                                               \
+            node->next = 0;                                                   \
+            for(i = 0; i < used && bins[i] != 0; i++)                         \
+            {                                                                 \
+                run = name##_merge_chains(list_ptr, bins[i], run);            \
+                bins[i] = 0;                                                  \
+            }                                                                 \
+            if(i == used)                                                     \
+                used++;                                                       \
+            bins[i] = run;                                                    \
+        }                                                                     \
+        run = 0;                                                              \
+        for(i = 0; i < used; i++)                                             \
+        {                                                                     \
+            if(bins[i] != 0)                                                  \
+                run = run == 0 ? bins[i] :                                    \
+                    name##_merge_chains(list_ptr, bins[i], run);              \
+        }                                                                     \
+                                                                              \
+        /* relink the prev links in one pass */                               \
+        prev = 0;                                                             \
+        for(; run != 0; run = node->next)                                     \
+        {                                                                     \
+            node = name##_node(list_ptr, run);                                \
+            name##_node(list_ptr, prev)->next = run;                          \
+            node->prev = prev;                                                \
+            prev = run;                                                       \
+        }                                                                     \
+        name##_node(list_ptr, prev)->next = 1;                                \
+        name##_node(list_ptr, 1)->prev = prev;                                \
+    }                                                                         \
+    list_ptr->list_sorted_state = LIST_TYPED_SORTED;                          \
+}
+
+#endif
+
+/* commands for vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
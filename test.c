@@ -0,0 +1,691 @@
+/* test.c
+ *
+ * Functional tests for the list ADT
+ *
+ * Each test_ function builds lists, checks their contents against what the
+ * operations should have produced, and runs list_debug_validate on them.
+ * A failed check is an assertion failure, so the tests must be built
+ * without NDEBUG.  Nothing is printed unless every test passed.
+ *
+ * Usage: list_test
+ */
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include "list.h"
+
+//Small arena segments, so that the compact lists span several of them
+#define LIST_COMPACT_SEGMENT_BITS 6
+#include "list_typed.h"
+
+#define TEST_SIZE 1000
+#define TEST_VIEW_PATH "list_test.view"
+
+void list_debug_validate(list_t *);
+
+LIST_DEFINE(intlist, int, (a < b) - (a > b))
+LIST_DEFINE_COMPACT(intcompact, int, (a < b) - (a > b))
+
+static int int_comp(void *a, void *b)
+{
+    int x = *(int *) a, y = *(int *) b;
+
+    return (x < y) - (x > y);
+}
+
+static unsigned long int_hash(void *a)
+{
+    return (unsigned long) *(int *) a * 2654435761UL;
+}
+
+static int *new_int(int value)
+{
+    int *elem = (int *) malloc(sizeof(int));
+
+    assert(elem != NULL);
+    *elem = value;
+    return elem;
+}
+
+static list_key_t int_key(void *a)
+{
+    list_key_t key;
+
+    key.i32 = *(int *) a;
+    return key;
+}
+
+/* Elements that compare by key alone, with a tag to tell equal ones apart */
+typedef struct
+{
+    int key;
+    int tag;
+} item_t;
+
+static int item_comp(void *a, void *b)
+{
+    int x = ((item_t *) a)->key, y = ((item_t *) b)->key;
+
+    return (x < y) - (x > y);
+}
+
+/* A sorted list of items with the n keys given, tagged tag, tag + 1, ... */
+static List item_list(const int *keys, int n, int tag)
+{
+    List list_ptr = list_construct();
+    item_t *item;
+    int i;
+
+    set_comp(list_ptr, item_comp);
+    for(i = 0; i < n; i++)
+    {
+        item = (item_t *) malloc(sizeof(item_t));
+        assert(item != NULL);
+        item->key = keys[i];
+        item->tag = tag + i;
+        list_insert(list_ptr, item, list_iter_tail(list_ptr));
+    }
+    return list_ptr;
+}
+
+/* Checks that the list holds the items tagged tags, in that order, and is
+ * still taken to be sorted like a new list */
+static void check_tags(List list_ptr, const int *tags, int n)
+{
+    List empty = list_construct();
+    Iterator idx_ptr = list_iter_first(list_ptr);
+    int i;
+
+    list_debug_validate(list_ptr);
+    assert(list_size(list_ptr) == n);
+    assert(list_ptr->list_sorted_state == empty->list_sorted_state);
+    for(i = 0; i < n; i++, idx_ptr = list_iter_next(idx_ptr))
+        assert(((item_t *) list_access(list_ptr, idx_ptr))->tag == tags[i]);
+    list_destruct(empty);
+}
+
+/* A sorted list holding from, from + 1, ... to - 1 */
+static List sorted_range(int from, int to)
+{
+    List list_ptr = list_construct();
+    int i;
+
+    set_comp(list_ptr, int_comp);
+    for(i = from; i < to; i++)
+        list_insert(list_ptr, new_int(i), list_iter_tail(list_ptr));
+    return list_ptr;
+}
+
+/* Checks that the list holds from, from + 1, ... to - 1 by position */
+static void check_at(List list_ptr, int from, int to)
+{
+    int i;
+
+    list_debug_validate(list_ptr);
+    assert(list_size(list_ptr) == to - from);
+    for(i = from; i < to; i++)
+        assert(*(int *) list_access(list_ptr, list_at(list_ptr, i - from)) == i);
+}
+
+/* the operations of a LIST_DEFINE list on ints held by value */
+static void test_typed(void)
+{
+    intlist_t *typed = intlist_construct();
+    intlist_node_t *node;
+    int i, prev;
+
+    for(i = 0; i < TEST_SIZE; i++)
+        intlist_insert(typed, (i * 7919) % TEST_SIZE, intlist_iter_tail(typed));
+    assert(intlist_size(typed) == TEST_SIZE);
+    assert(*intlist_access(typed, intlist_iter_first(typed)) == 0);
+    assert(intlist_access(typed, intlist_iter_tail(typed)) == NULL);
+
+    intlist_sort(typed);
+    prev = -1;
+    for(node = intlist_iter_first(typed); node != intlist_iter_tail(typed);
+            node = intlist_iter_next(node))
+    {
+        assert(*intlist_access(typed, node) == prev + 1);
+        prev = *intlist_access(typed, node);
+    }
+
+    //Equal elements go after the ones already there
+    intlist_insert_sorted(typed, 500);
+    node = intlist_elem_find(typed, 500);
+    assert(node != NULL && intlist_iter_next(node)->data == 500);
+    assert(intlist_remove(typed, node) == 500);
+    assert(intlist_elem_find(typed, TEST_SIZE) == NULL);
+    assert(intlist_size(typed) == TEST_SIZE);
+    intlist_destruct(typed);
+}
+
+/* the same for a LIST_DEFINE_COMPACT list, whose nodes are reused by index */
+static void test_compact(void)
+{
+    intcompact_t *compact = intcompact_construct();
+    intcompact_iter_t idx;
+    int i, prev;
+
+    for(i = 0; i < TEST_SIZE; i++)
+        intcompact_insert(compact, (i * 7919) % TEST_SIZE,
+                intcompact_iter_tail(compact));
+    assert(intcompact_size(compact) == TEST_SIZE);
+    assert(*intcompact_access(compact, intcompact_iter_first(compact)) == 0);
+    assert(intcompact_access(compact, intcompact_iter_tail(compact)) == NULL);
+
+    intcompact_sort(compact);
+    prev = -1;
+    for(idx = intcompact_iter_first(compact); idx != intcompact_iter_tail(compact);
+            idx = intcompact_iter_next(compact, idx))
+    {
+        assert(*intcompact_access(compact, idx) == prev + 1);
+        prev = *intcompact_access(compact, idx);
+    }
+
+    intcompact_insert_sorted(compact, 500);
+    idx = intcompact_elem_find(compact, 500);
+    assert(idx != 0);
+    assert(*intcompact_access(compact, intcompact_iter_next(compact, idx)) == 500);
+    assert(intcompact_remove(compact, idx) == 500);
+    assert(intcompact_elem_find(compact, TEST_SIZE) == 0);
+
+    //Removed nodes are handed out again
+    for(i = 0; i < TEST_SIZE / 2; i++)
+        intcompact_remove(compact, intcompact_iter_first(compact));
+    for(i = 0; i < TEST_SIZE / 2; i++)
+        intcompact_insert_sorted(compact, i);
+    assert(intcompact_size(compact) == TEST_SIZE);
+    prev = -1;
+    for(idx = intcompact_iter_first(compact); idx != intcompact_iter_tail(compact);
+            idx = intcompact_iter_next(compact, idx))
+    {
+        assert(*intcompact_access(compact, idx) == prev + 1);
+        prev = *intcompact_access(compact, idx);
+    }
+    intcompact_destruct(compact);
+}
+
+/* Splices that keep the destination sorted must still make its indexes
+ * stale, since the moved nodes are not in them.  list_at builds the order
+ * index before each splice.
+ */
+static void test_splice_sorted(void)
+{
+    List dst = sorted_range(0, TEST_SIZE), src = sorted_range(TEST_SIZE, 2 * TEST_SIZE);
+    List empty, removed;
+
+    check_at(dst, 0, TEST_SIZE);
+    check_at(src, TEST_SIZE, 2 * TEST_SIZE);
+    list_append_list(dst, src);
+    check_at(dst, 0, 2 * TEST_SIZE);
+    check_at(src, 0, 0);
+
+    removed = list_remove_range(dst, list_at(dst, TEST_SIZE), list_iter_tail(dst));
+    check_at(dst, 0, TEST_SIZE);
+    check_at(removed, TEST_SIZE, 2 * TEST_SIZE);
+
+    //Merging into an empty list moves the whole of the other one
+    empty = sorted_range(0, 0);
+    check_at(empty, 0, 0);
+    list_merge_sorted(empty, removed);
+    check_at(empty, TEST_SIZE, 2 * TEST_SIZE);
+
+    list_destruct(dst);
+    list_destruct(src);
+    list_destruct(empty);
+    list_destruct(removed);
+}
+
+/* list_elem_find through a hash index after appending a sorted list */
+static void test_hash_splice(void)
+{
+    List dst = sorted_range(0, TEST_SIZE), src = sorted_range(TEST_SIZE, 2 * TEST_SIZE);
+    Iterator idx_ptr;
+    int i;
+
+    set_hash(dst, int_hash);
+    i = 0;
+    assert(list_elem_find(dst, &i) == list_iter_first(dst));
+    list_append_list(dst, src);
+    for(i = 0; i < 2 * TEST_SIZE; i++)
+    {
+        idx_ptr = list_elem_find(dst, &i);
+        assert(idx_ptr != NULL && *(int *) list_access(dst, idx_ptr) == i);
+    }
+    list_destruct(dst);
+    list_destruct(src);
+}
+
+/* list_key_count, list_key_find and list_elem_find through a key column
+ * after appending a sorted list */
+static void test_key_splice(void)
+{
+    List dst = sorted_range(0, TEST_SIZE), src = sorted_range(TEST_SIZE, 2 * TEST_SIZE);
+    list_key_t lo, hi;
+    Iterator idx_ptr;
+    int i;
+
+    set_key_column(dst, int_key, LIST_KEY_INT32);
+    lo.i32 = 0;
+    hi.i32 = 2 * TEST_SIZE - 1;
+    assert(list_key_count(dst, lo, hi) == TEST_SIZE);
+    list_append_list(dst, src);
+    assert(list_key_count(dst, lo, hi) == 2 * TEST_SIZE);
+    lo.i32 = TEST_SIZE;
+    assert(list_key_count(dst, lo, hi) == TEST_SIZE);
+    for(i = 0; i < 2 * TEST_SIZE; i++)
+    {
+        lo.i32 = hi.i32 = i;
+        idx_ptr = list_key_find(dst, lo, hi);
+        assert(idx_ptr != NULL && *(int *) list_access(dst, idx_ptr) == i);
+        assert(list_elem_find(dst, &i) == idx_ptr);
+    }
+    assert(list_elem_find(dst, &i) == NULL);
+    list_destruct(dst);
+    list_destruct(src);
+}
+
+/* list_elem_find through a hash index while equal elements are inserted
+ * in the middle of the list and the first of them removed, which must not
+ * build the order index */
+static void test_hash_groups(void)
+{
+    List list_ptr = list_construct();
+    Iterator idx_ptr, mid;
+    int i, value;
+
+    set_comp(list_ptr, int_comp);
+    set_hash(list_ptr, int_hash);
+    for(i = 0; i < TEST_SIZE; i++)
+        list_insert(list_ptr, new_int(i % 10), list_iter_tail(list_ptr));
+    value = 0;
+    assert(list_elem_find(list_ptr, &value) == list_iter_first(list_ptr));
+    mid = list_iter_first(list_ptr);
+    for(i = 0; i < TEST_SIZE / 2 + 5; i++)
+        mid = list_iter_next(mid);
+    for(i = 0; i < 10; i++)
+        list_insert(list_ptr, new_int(i), mid);
+    assert(list_ptr->rank_index == NULL);
+
+    //Each remove of a group's first leaves the next one in list order first
+    for(i = 0; i < TEST_SIZE + 10; i++)
+    {
+        value = i % 10;
+        idx_ptr = list_elem_find(list_ptr, &value);
+        assert(idx_ptr != NULL && *(int *) list_access(list_ptr, idx_ptr) == value);
+        free(list_remove(list_ptr, idx_ptr));
+        idx_ptr = list_iter_first(list_ptr);
+        while(idx_ptr != list_iter_tail(list_ptr) &&
+                *(int *) list_access(list_ptr, idx_ptr) != value)
+            idx_ptr = list_iter_next(idx_ptr);
+        assert(list_elem_find(list_ptr, &value) ==
+                (idx_ptr != list_iter_tail(list_ptr) ? idx_ptr : NULL));
+    }
+    assert(list_size(list_ptr) == 0 && list_ptr->rank_index == NULL);
+    list_destruct(list_ptr);
+}
+
+/* The set algebra on sorted lists with duplicates, checking which of equal
+ * elements move and that every list stays sorted */
+static void test_set_algebra(void)
+{
+    static const int dst_keys[] = { 1, 3, 5 };
+    static const int src_keys[] = { 1, 2, 2, 3, 4, 4, 6 };
+    static const int dup_keys[] = { 1, 1, 2, 3, 3, 5 };
+    static const int other_keys[] = { 1, 3, 3, 3, 4 };
+    static const int run_keys[] = { 1, 1, 2, 3, 3, 3, 5 };
+    static const int many_a[] = { 1, 2, 2 }, many_b[] = { 2, 3 }, many_c[] = { 0, 2 };
+    List dst, src, other, removed, lists[3];
+
+    //Only the first of several equal elements of src moves
+    dst = item_list(dst_keys, 3, 0);
+    src = item_list(src_keys, 7, 10);
+    list_union(dst, src);
+    check_tags(dst, (int []) { 0, 11, 1, 14, 2, 16 }, 6);
+    check_tags(src, (int []) { 10, 12, 13, 15 }, 4);
+    list_destruct(src);
+
+    //Of equal elements those of dst stay first
+    src = item_list(many_b, 2, 10);
+    list_merge_sorted(dst, src);
+    check_tags(dst, (int []) { 0, 11, 10, 1, 11, 14, 2, 16 }, 8);
+    check_tags(src, NULL, 0);
+    list_destruct(dst);
+    list_destruct(src);
+
+    dst = item_list(dup_keys, 6, 0);
+    other = item_list(other_keys, 5, 10);
+    removed = list_intersect(dst, other);
+    check_tags(dst, (int []) { 0, 1, 3, 4 }, 4);
+    check_tags(removed, (int []) { 2, 5 }, 2);
+    check_tags(other, (int []) { 10, 11, 12, 13, 14 }, 5);
+    list_destruct(dst);
+    list_destruct(removed);
+
+    dst = item_list(dup_keys, 6, 0);
+    removed = list_difference(dst, other);
+    check_tags(dst, (int []) { 2, 5 }, 2);
+    check_tags(removed, (int []) { 0, 1, 3, 4 }, 4);
+    check_tags(other, (int []) { 10, 11, 12, 13, 14 }, 5);
+    list_destruct(dst);
+    list_destruct(removed);
+    list_destruct(other);
+
+    dst = item_list(run_keys, 7, 0);
+    removed = list_unique(dst);
+    check_tags(dst, (int []) { 0, 2, 3, 6 }, 4);
+    check_tags(removed, (int []) { 1, 4, 5 }, 3);
+    list_destruct(dst);
+    list_destruct(removed);
+
+    //Of equal elements those of the earlier list come first
+    lists[0] = item_list(many_a, 3, 0);
+    lists[1] = item_list(many_b, 2, 10);
+    lists[2] = item_list(many_c, 2, 20);
+    list_merge_many(lists, 3);
+    check_tags(lists[0], (int []) { 20, 0, 1, 2, 10, 21, 11 }, 7);
+    check_tags(lists[1], NULL, 0);
+    check_tags(lists[2], NULL, 0);
+    list_destruct(lists[0]);
+    list_destruct(lists[1]);
+    list_destruct(lists[2]);
+}
+
+static item_t *new_item(int key, int tag)
+{
+    item_t *item = (item_t *) malloc(sizeof(item_t));
+
+    assert(item != NULL);
+    item->key = key;
+    item->tag = tag;
+    return item;
+}
+
+/* Pops the queue empty, checking that keys come in order and equal keys in
+ * push order, which the tags follow; returns how many had key */
+static int pq_drain(PQueue pq, int key)
+{
+    item_t *item, last = { -1, -1 };
+    int count = 0;
+
+    while(pq_size(pq) > 0)
+    {
+        item = (item_t *) pq_pop(pq);
+        assert(item->key > last.key || (item->key == last.key && item->tag > last.tag));
+        count += item->key == key;
+        last = *item;
+        free(item);
+    }
+    assert(pq_pop(pq) == NULL);
+    return count;
+}
+
+/* Equal elements of a priority queue pop in push order, also when pushes
+ * and pops interleave and after pq_decrease_key */
+static void test_pq_fifo(void)
+{
+    PQueue pq = pq_construct();
+    PQHandle handles[TEST_SIZE];
+    item_t *items[TEST_SIZE], *item;
+    int i;
+
+    pq_set_comp(pq, item_comp);
+    for(i = 0; i < TEST_SIZE / 2; i++)
+        pq_push(pq, new_item(0, i));
+    for(i = 0; i < TEST_SIZE / 10; i++)
+    {
+        item = (item_t *) pq_pop(pq);
+        assert(item->tag == i);
+        free(item);
+    }
+    for(i = TEST_SIZE / 2; i < TEST_SIZE; i++)
+        pq_push(pq, new_item(0, i));
+    assert(pq_drain(pq, 0) == TEST_SIZE - TEST_SIZE / 10);
+
+    for(i = 0; i < TEST_SIZE; i++)
+    {
+        items[i] = new_item(i % 10, i);
+        handles[i] = pq_push(pq, items[i]);
+    }
+    for(i = 0; i < TEST_SIZE / 2; i++)
+    {
+        if(items[i]->key != 9)
+            continue;
+        items[i]->key = 3;
+        pq_decrease_key(pq, handles[i]);
+    }
+    assert(pq_size(pq) == TEST_SIZE);
+    assert(pq_drain(pq, 3) == TEST_SIZE / 10 + TEST_SIZE / 20);
+    pq_destruct(pq);
+}
+
+/* Orders items by key and then by tag, which is how a stable sort orders
+ * items tagged with their position */
+static int item_stable_order(const void *a, const void *b)
+{
+    const item_t *x = *(item_t * const *) a, *y = *(item_t * const *) b;
+
+    if(x->key != y->key)
+        return (x->key > y->key) - (x->key < y->key);
+    return (x->tag > y->tag) - (x->tag < y->tag);
+}
+
+static void *item_same(void *elem, void *arg)
+{
+    (void) arg;
+    return elem;
+}
+
+/* Checks list_nth_element at every position of the list against the stable
+ * order of its items, and that the list did not change */
+static void check_nth(List list_ptr)
+{
+    item_t *order[TEST_SIZE];
+    Iterator idx_ptr;
+    int i, n = list_size(list_ptr);
+
+    assert(n <= TEST_SIZE);
+    idx_ptr = list_iter_first(list_ptr);
+    for(i = 0; i < n; i++, idx_ptr = list_iter_next(idx_ptr))
+        order[i] = (item_t *) list_access(list_ptr, idx_ptr);
+    qsort(order, n, sizeof(item_t *), item_stable_order);
+    for(i = 0; i < n; i++)
+        assert(list_access(list_ptr, list_nth_element(list_ptr, i)) == order[i]);
+    idx_ptr = list_iter_first(list_ptr);
+    for(i = 0; i < n; i++, idx_ptr = list_iter_next(idx_ptr))
+        assert(((item_t *) list_access(list_ptr, idx_ptr))->tag == i);
+    list_debug_validate(list_ptr);
+}
+
+/* list_partial_sort and list_nth_element against a stable sort, on input
+ * with many duplicates and on input that is already sorted */
+static void test_select(void)
+{
+    static const int ks[] = { 1, 10, TEST_SIZE / 2, TEST_SIZE - 1, TEST_SIZE, TEST_SIZE + 5 };
+    int keys[TEST_SIZE], tags[TEST_SIZE];
+    char front[TEST_SIZE];
+    item_t *order[TEST_SIZE];
+    List list_ptr;
+    Iterator idx_ptr;
+    int i, j, k, rest;
+
+    srand(1);
+    for(i = 0; i < TEST_SIZE; i++)
+        keys[i] = rand() % 20;
+    for(j = 0; j < (int) (sizeof(ks) / sizeof(ks[0])); j++)
+    {
+        k = ks[j] < TEST_SIZE ? ks[j] : TEST_SIZE;
+        list_ptr = item_list(keys, TEST_SIZE, 0);
+        idx_ptr = list_iter_first(list_ptr);
+        for(i = 0; i < TEST_SIZE; i++, idx_ptr = list_iter_next(idx_ptr))
+            order[i] = (item_t *) list_access(list_ptr, idx_ptr);
+        qsort(order, TEST_SIZE, sizeof(item_t *), item_stable_order);
+
+        //The first k of a stable sort, then the others in list order
+        list_partial_sort(list_ptr, ks[j]);
+        list_debug_validate(list_ptr);
+        memset(front, 0, sizeof(front));
+        for(i = 0; i < k; i++)
+        {
+            tags[i] = order[i]->tag;
+            front[tags[i]] = 1;
+        }
+        rest = k;
+        for(i = 0; i < TEST_SIZE; i++)
+            if(!front[i])
+                tags[rest++] = i;
+        idx_ptr = list_iter_first(list_ptr);
+        for(i = 0; i < TEST_SIZE; i++, idx_ptr = list_iter_next(idx_ptr))
+            assert(((item_t *) list_access(list_ptr, idx_ptr))->tag == tags[i]);
+        list_destruct(list_ptr);
+    }
+
+    list_ptr = item_list(keys, TEST_SIZE, 0);
+    check_nth(list_ptr);
+    list_destruct(list_ptr);
+
+    //Sorted, and then in order but no longer taken to be sorted
+    for(i = 0; i < TEST_SIZE; i++)
+        keys[i] = i / 3;
+    list_ptr = item_list(keys, TEST_SIZE, 0);
+    check_nth(list_ptr);
+    list_map_inplace(list_ptr, item_same, NULL, 1);
+    check_nth(list_ptr);
+    list_destruct(list_ptr);
+}
+
+/* list_insert_array in the middle of a list with an order index */
+static void test_insert_array(void)
+{
+    List list_ptr = sorted_range(0, TEST_SIZE / 2);
+    void *elems[TEST_SIZE / 2];
+    int i;
+
+    check_at(list_ptr, 0, TEST_SIZE / 2);
+    for(i = 0; i < TEST_SIZE / 2; i++)
+        elems[i] = new_int(TEST_SIZE / 4 + i);
+    for(i = TEST_SIZE / 4; i < TEST_SIZE / 2; i++)
+        *(int *) list_access(list_ptr, list_at(list_ptr, i)) += TEST_SIZE / 2;
+    list_insert_array(list_ptr, elems, TEST_SIZE / 2,
+            list_at(list_ptr, TEST_SIZE / 4));
+    check_at(list_ptr, 0, TEST_SIZE);
+    list_destruct(list_ptr);
+}
+
+static size_t int_serialize(void *elem, void *buf, size_t buf_size)
+{
+    if(buf_size >= sizeof(int))
+        *(int *) buf = *(int *) elem;
+    return sizeof(int);
+}
+
+/* The number of elements reached walking the view forward from its start */
+static int view_walk(ListView view)
+{
+    ViewIter it;
+    int count = 0;
+
+    for(it = list_view_first(view); it != NULL; it = list_view_next(view, it))
+        count++;
+    return count;
+}
+
+/* Walking a saved list whose links were damaged stops at the damage.  The
+ * links are changed in the view's private mapping, where a record is its
+ * next, prev and size offsets as uint64_t followed by the element bytes.
+ */
+static void test_view_damaged(void)
+{
+    List list_ptr = sorted_range(0, TEST_SIZE);
+    ListView view;
+    ViewIter mid;
+    uint64_t *rec, next;
+    int i;
+
+    assert(list_save(list_ptr, TEST_VIEW_PATH, int_serialize) == 0);
+    list_destruct(list_ptr);
+    view = list_open_mmap(TEST_VIEW_PATH);
+    assert(view != NULL && list_view_size(view) == TEST_SIZE);
+    assert(view_walk(view) == TEST_SIZE);
+
+    mid = list_view_first(view);
+    for(i = 0; i < TEST_SIZE / 2; i++)
+        mid = list_view_next(view, mid);
+    assert(*(int *) list_view_access(view, mid, NULL) == TEST_SIZE / 2);
+    rec = (uint64_t *) list_view_access(view, mid, NULL) - 3;
+    next = rec[0];
+
+    rec[0] = next + 1;              //misaligned
+    assert(view_walk(view) == TEST_SIZE / 2 + 1);
+    rec[0] = 8;                     //inside the header
+    assert(view_walk(view) == TEST_SIZE / 2 + 1);
+    rec[0] = UINT64_MAX & ~(uint64_t) 7;    //past the end of the file
+    assert(view_walk(view) == TEST_SIZE / 2 + 1);
+    rec[0] = next;
+    rec[2] = UINT64_MAX;            //element bytes past the end of the file
+    assert(view_walk(view) == TEST_SIZE / 2);
+    assert(list_view_prev(view, list_view_next(view, list_view_first(view))) ==
+            list_view_first(view));
+    list_view_close(view);
+
+    //A file cut short is refused
+    assert(truncate(TEST_VIEW_PATH, 100) == 0);
+    assert(list_open_mmap(TEST_VIEW_PATH) == NULL);
+    remove(TEST_VIEW_PATH);
+}
+
+/* Saving over a file replaces it whole: a view of the old file still walks
+ * all of it, and a save that fails leaves the old file as it was */
+static void test_view_replace(void)
+{
+    List list_ptr = sorted_range(0, TEST_SIZE);
+    ListView old_view, view;
+    ViewIter it;
+    int i;
+
+    assert(list_save(list_ptr, TEST_VIEW_PATH, int_serialize) == 0);
+    list_destruct(list_ptr);
+    old_view = list_open_mmap(TEST_VIEW_PATH);
+    assert(old_view != NULL);
+
+    list_ptr = sorted_range(0, 10);
+    assert(list_save(list_ptr, TEST_VIEW_PATH, int_serialize) == 0);
+    i = 0;
+    for(it = list_view_first(old_view); it != NULL; it = list_view_next(old_view, it))
+        assert(*(int *) list_view_access(old_view, it, NULL) == i++);
+    assert(i == TEST_SIZE);
+    list_view_close(old_view);
+
+    //The file list_save writes first cannot be created
+    assert(mkdir(TEST_VIEW_PATH ".tmp", 0700) == 0);
+    assert(list_save(list_ptr, TEST_VIEW_PATH, int_serialize) == -1);
+    assert(rmdir(TEST_VIEW_PATH ".tmp") == 0);
+    view = list_open_mmap(TEST_VIEW_PATH);
+    assert(view != NULL && list_view_size(view) == 10 && view_walk(view) == 10);
+    list_view_close(view);
+    list_destruct(list_ptr);
+    remove(TEST_VIEW_PATH);
+}
+
+int main(void)
+{
+    test_typed();
+    test_compact();
+    test_splice_sorted();
+    test_insert_array();
+    test_hash_splice();
+    test_hash_groups();
+    test_set_algebra();
+    test_pq_fifo();
+    test_select();
+    test_key_splice();
+    test_view_damaged();
+    test_view_replace();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+/* test_queue.c
+ *
+ * Concurrency stress test for the list_queue_ functions
+ *
+ * QUEUE_PRODUCERS threads each push QUEUE_ITEMS distinct elements onto one
+ * ListQueue while QUEUE_CONSUMERS threads pop from it until every element
+ * has been taken.  Each element records how many times it was popped, and
+ * the test fails unless every pushed element was popped exactly once.
+ * The make target builds it with -fsanitize=thread, so that a data race in
+ * the queue is reported even when the counts come out right.  Nothing is
+ * printed unless the test passed.
+ *
+ * Usage: list_test_queue
+ */
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "list.h"
+
+#define QUEUE_PRODUCERS 4
+#define QUEUE_CONSUMERS 4
+#define QUEUE_ITEMS 100000
+
+typedef struct
+{
+    atomic_int pops;
+} item_t;
+
+static ListQueue queue;
+static item_t items[QUEUE_PRODUCERS][QUEUE_ITEMS];
+static atomic_long popped;
+
+static void *producer(void *arg)
+{
+    item_t *mine = arg;
+    int i;
+
+    for(i = 0; i < QUEUE_ITEMS; i++)
+        list_queue_push(queue, &mine[i]);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    item_t *item;
+
+    (void) arg;
+    //Spin until the producers' last element has been taken by someone
+    while(atomic_load(&popped) < (long) QUEUE_PRODUCERS * QUEUE_ITEMS)
+    {
+        if((item = list_queue_pop(queue)) == NULL)
+            continue;
+        atomic_fetch_add(&item->pops, 1);
+        atomic_fetch_add(&popped, 1);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t producers[QUEUE_PRODUCERS], consumers[QUEUE_CONSUMERS];
+    int i, j;
+
+    queue = list_queue_construct();
+    for(i = 0; i < QUEUE_CONSUMERS; i++)
+        assert(pthread_create(&consumers[i], NULL, consumer, NULL) == 0);
+    for(i = 0; i < QUEUE_PRODUCERS; i++)
+        assert(pthread_create(&producers[i], NULL, producer, items[i]) == 0);
+    for(i = 0; i < QUEUE_PRODUCERS; i++)
+        assert(pthread_join(producers[i], NULL) == 0);
+    for(i = 0; i < QUEUE_CONSUMERS; i++)
+        assert(pthread_join(consumers[i], NULL) == 0);
+
+    assert(list_queue_pop(queue) == NULL);
+    for(i = 0; i < QUEUE_PRODUCERS; i++)
+        for(j = 0; j < QUEUE_ITEMS; j++)
+            assert(atomic_load(&items[i][j].pops) == 1);
+    list_queue_destruct(queue);
+    printf("ok\n");
+    return 0;
+}